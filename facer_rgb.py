@@ -1,6 +1,9 @@
 #!/usr/bin/env python3
 import argparse
+import errno
+import fcntl
 import json
+import struct
 from pathlib import Path
 
 PAYLOAD_SIZE = 16
@@ -9,6 +12,32 @@ CHARACTER_DEVICE = "/dev/acer-gkbbl-0"
 PAYLOAD_SIZE_STATIC_MODE = 4
 CHARACTER_DEVICE_STATIC = "/dev/acer-gkbbl-static-0"
 
+# Typed ioctl interface of CHARACTER_DEVICE, see README
+API_VERSION = 1
+EFFECT_FORMAT = "<I7B5x"
+ZONES_FORMAT = "<II32s"
+STATIC_FORMAT = "<IB3xII32s"
+
+
+def _iow(nr, size):
+    return (1 << 30) | (size << 16) | (0xAC << 8) | nr
+
+
+IOC_SET_EFFECT = _iow(0x03, struct.calcsize(EFFECT_FORMAT))
+IOC_SET_STATIC = _iow(0x05, struct.calcsize(STATIC_FORMAT))
+
+
+def send_ioctl(request, data):
+    """Returns False if the loaded module predates the ioctl interface"""
+    with open(CHARACTER_DEVICE, 'wb') as cd:
+        try:
+            fcntl.ioctl(cd, request, data)
+        except OSError as e:
+            if e.errno == errno.ENOTTY:
+                return False
+            raise
+    return True
+
 CONFIG_DIRECTORY = str(Path.home()) + "/.config/predator/saved profiles"
 path = Path(CONFIG_DIRECTORY)
 path.mkdir(parents=True, exist_ok=True)
@@ -23,9 +52,10 @@ parser = argparse.ArgumentParser(description=f"""Interacts with experimental Ace
     4 -> Shifting [Accepts RGB color]
     5 -> Zoom [Accepts RGB color]
 
--z [ZoneID]
+-z [ZoneID ...]
     Zone ID(Only in static mode):
     Possible values: 1,2,3,4
+    Several zones can be given at once and are written in a single request
 
 -s [speed]
     Animation Speed:
@@ -108,8 +138,9 @@ parser.add_argument('-m',
 
 parser.add_argument('-z',
                     type=int,
+                    nargs='+',
                     dest='zone',
-                    default=1)
+                    default=[1])
 
 parser.add_argument('-s',
                     type=int,
@@ -169,38 +200,47 @@ if args.save:
 
 if args.mode == 0:
     # Static coloring mode
-    payload = [0] * PAYLOAD_SIZE_STATIC_MODE
-    if args.zone < 1 or args.zone > 8:
-        print("Invalid Zone ID entered! Possible values are: 1, 2, 3, 4 from left to right")
-    payload[0] = 1 << (args.zone - 1)
-    payload[1] = args.red
-    payload[2] = args.green
-    payload[3] = args.blue
-    with open(CHARACTER_DEVICE_STATIC, 'wb') as cd:
-        cd.write(bytes(payload))
-
-    # Tell WMI To use STATIC coloring
-    # Dynamic coloring mode
-    payload = [0] * PAYLOAD_SIZE
-    payload[2] = args.brightness
-    payload[9] = 1
-    with open(CHARACTER_DEVICE, 'wb') as cd:
-        cd.write(bytes(payload))
+    # Profiles saved by older versions store a single zone
+    zones = args.zone if isinstance(args.zone, list) else [args.zone]
+    payload = []
+    for zone in zones:
+        if zone < 1 or zone > 8:
+            print("Invalid Zone ID entered! Possible values are: 1, 2, 3, 4 from left to right")
+            exit(1)
+        payload += [1 << (zone - 1), args.red, args.green, args.blue]
+
+    request = struct.pack(STATIC_FORMAT, API_VERSION, args.brightness,
+                          API_VERSION, len(zones), bytes(payload))
+    if not send_ioctl(IOC_SET_STATIC, request):
+        with open(CHARACTER_DEVICE_STATIC, 'wb') as cd:
+            cd.write(bytes(payload))
+
+        # Tell WMI To use STATIC coloring
+        # Dynamic coloring mode
+        payload = [0] * PAYLOAD_SIZE
+        payload[2] = args.brightness
+        payload[9] = 1
+        with open(CHARACTER_DEVICE, 'wb') as cd:
+            cd.write(bytes(payload))
 
 
 
 else:
     # Dynamic coloring mode
-    payload = [0] * PAYLOAD_SIZE
-    payload[0] = args.mode
-    payload[1] = args.speed
-    payload[2] = args.brightness
-    payload[3] = 8 if args.mode == 3 else 0
-    payload[4] = args.direction
-    payload[5] = args.red
-    payload[6] = args.green
-    payload[7] = args.blue
-    payload[9] = 1
-
-    with open(CHARACTER_DEVICE, 'wb') as cd:
-        cd.write(bytes(payload))
+    request = struct.pack(EFFECT_FORMAT, API_VERSION, args.mode, args.speed,
+                          args.brightness, args.direction, args.red,
+                          args.green, args.blue)
+    if not send_ioctl(IOC_SET_EFFECT, request):
+        payload = [0] * PAYLOAD_SIZE
+        payload[0] = args.mode
+        payload[1] = args.speed
+        payload[2] = args.brightness
+        payload[3] = 8 if args.mode == 3 else 0
+        payload[4] = args.direction
+        payload[5] = args.red
+        payload[6] = args.green
+        payload[7] = args.blue
+        payload[9] = 1
+
+        with open(CHARACTER_DEVICE, 'wb') as cd:
+            cd.write(bytes(payload))
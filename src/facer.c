@@ -32,11 +32,14 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/delay.h>
+#include <linux/random.h>
 #include <linux/types.h>
 #include <linux/dmi.h>
 #include <linux/fb.h>
 #include <linux/backlight.h>
 #include <linux/leds.h>
+#include <linux/led-class-multicolor.h>
 #include <linux/platform_device.h>
 #include <linux/platform_profile.h>
 #include <linux/acpi.h>
@@ -44,19 +47,39 @@
 #include <linux/rfkill.h>
 #include <linux/workqueue.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/uuid.h>
+#include <linux/rwsem.h>
+#include <linux/mm.h>
+#include <linux/math64.h>
+#include <linux/kfifo.h>
+#include <linux/hrtimer.h>
+#include <linux/poll.h>
 #include <linux/input.h>
 #include <linux/cdev.h>
 #include <linux/input/sparse-keymap.h>
 #include <acpi/video.h>
 #include <linux/hwmon.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include <linux/thermal.h>
 #include <linux/bitfield.h>
 #include <linux/version.h>
 
 #if RTLNX_VER_MIN(6, 14, 0)
 #include <linux/unaligned.h>
+#else
+#include <asm/unaligned.h>
 #endif
 
+#define CREATE_TRACE_POINTS
+#include "facer_trace.h"
+
 MODULE_AUTHOR("Carlos Corbacho");
 MODULE_DESCRIPTION("Acer Laptop WMI Extras Driver");
 MODULE_LICENSE("GPL");
@@ -137,9 +160,9 @@ enum acer_wmi_event_ids {
 };
 
 enum acer_wmi_predator_v4_sys_info_command {
+	ACER_WMID_CMD_GET_PREDATOR_V4_SUPPORTED_SENSORS = 0x00,
+	ACER_WMID_CMD_GET_PREDATOR_V4_SENSOR_READING = 0x01,
 	ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS = 0x02,
-	ACER_WMID_CMD_GET_PREDATOR_V4_CPU_FAN_SPEED = 0x0201,
-	ACER_WMID_CMD_GET_PREDATOR_V4_GPU_FAN_SPEED = 0x0601,
 };
 
 enum acer_wmi_predator_v4_sensor_id {
@@ -263,11 +286,104 @@ struct event_return_value {
 /*
  * Gaming functions user-space communication
  * A character drive will be exposed in /dev/acer-gkbbl-static as char block for keyboard static backlight config
- * Config length is 16 bytes
+ * Config is a packed array of 4 byte zone records, up to GAMING_KBBL_STATIC_MAX_ZONES per write
  */
 
 #define GAMING_KBBL_STATIC_CHR "acer-gkbbl-static"
 #define GAMING_KBBL_STATIC_CONFIG_LEN 4
+#define GAMING_KBBL_STATIC_MAX_ZONES 8
+#define GAMING_KBBL_ZONES 4
+
+struct led_zone_set_param {
+		u8 zone;
+		u8 red;
+		u8 green;
+		u8 blue;
+} __packed;
+
+/*
+ * ioctl interface of the keyboard backlight character devices
+ */
+#define GAMING_KBBL_IOC_MAGIC 0xAC
+#define GAMING_KBBL_IOC_DOORBELL _IO(GAMING_KBBL_IOC_MAGIC, 0x01)
+#define GAMING_KBBL_IOC_QUEUE_FRAMES _IOW(GAMING_KBBL_IOC_MAGIC, 0x02, struct gkbbl_frame_batch)
+#define GAMING_KBBL_IOC_SET_EFFECT _IOW(GAMING_KBBL_IOC_MAGIC, 0x03, struct gkbbl_effect)
+#define GAMING_KBBL_IOC_SET_ZONES _IOW(GAMING_KBBL_IOC_MAGIC, 0x04, struct gkbbl_zones)
+#define GAMING_KBBL_IOC_SET_STATIC _IOW(GAMING_KBBL_IOC_MAGIC, 0x05, struct gkbbl_static)
+#define GAMING_KBBL_IOC_GET_CONFIG _IOR(GAMING_KBBL_IOC_MAGIC, 0x06, u8[GAMING_KBBL_CONFIG_LEN])
+
+/*
+ * Typed lighting requests for /dev/acer-gkbbl-0. version must be
+ * GAMING_KBBL_API_VERSION and reserved fields must be zero, so later
+ * versions can extend the structs.
+ */
+#define GAMING_KBBL_API_VERSION 1
+#define GAMING_KBBL_MAX_MODE 5
+#define GAMING_KBBL_MAX_SPEED 9
+#define GAMING_KBBL_MAX_BRIGHTNESS 100
+#define GAMING_KBBL_MAX_DIRECTION 2
+
+struct gkbbl_effect {
+	u32 version;
+	u8 mode;	/* 0 static, 1 breath, 2 neon, 3 wave, 4 shifting, 5 zoom */
+	u8 speed;	/* 0 stops the animation, 1 to 9 used by PredatorSense */
+	u8 brightness;	/* 0 to 100 */
+	u8 direction;	/* 1 right to left, 2 left to right */
+	u8 red;
+	u8 green;
+	u8 blue;
+	u8 reserved[5];
+};
+
+struct gkbbl_zones {
+	u32 version;
+	u32 count;	/* Used entries of zones, 1 to GAMING_KBBL_STATIC_MAX_ZONES */
+	struct led_zone_set_param zones[GAMING_KBBL_STATIC_MAX_ZONES];
+};
+
+/* Static colours and switch the keyboard to static mode at brightness */
+struct gkbbl_static {
+	u32 version;
+	u8 brightness;
+	u8 reserved[3];
+	struct gkbbl_zones zones;
+};
+
+/*
+ * Frame for the timed queue of /dev/acer-gkbbl-static-0, applied at
+ * deadline_ns (CLOCK_MONOTONIC). Zone records with an empty zone mask are
+ * ignored.
+ */
+struct gkbbl_timed_frame {
+	u64 deadline_ns;
+	struct led_zone_set_param zones[GAMING_KBBL_ZONES];
+} __packed;
+
+struct gkbbl_frame_batch {
+	u64 frames;	/* User pointer to an array of struct gkbbl_timed_frame */
+	u32 count;
+	u32 reserved;	/* Must be zero */
+};
+
+/*
+ * Page shared with user space through mmap on /dev/acer-gkbbl-0.
+ * seq works as a seqcount: user space makes it odd, updates flags, the
+ * effect config and zone colours, makes it even again and rings
+ * GAMING_KBBL_IOC_DOORBELL. The driver only takes a snapshot with an even
+ * seq that didn't change while copying, pushes the parts selected in flags
+ * and stores the seq it applied in applied_seq. Zone records with an empty
+ * zone mask are ignored.
+ */
+#define GAMING_KBBL_SHARED_EFFECT	BIT(0)
+#define GAMING_KBBL_SHARED_ZONES	BIT(1)
+
+struct gkbbl_shared_state {
+	u32 seq;
+	u32 flags;
+	u8 effect[GAMING_KBBL_CONFIG_LEN];
+	struct led_zone_set_param zones[GAMING_KBBL_STATIC_MAX_ZONES];
+	u32 applied_seq;
+} __packed;
 
 /* Hotkey Customized Setting and Acer Application Status.
  * Set Device Default Value and Report Acer Application Status.
@@ -347,6 +463,7 @@ struct hotkey_function_type_aa {
 #define ACER_CAP_FAN_SPEED_READ		BIT(11)
 #define ACER_CAP_GAMINGKB		BIT(12)
 #define ACER_CAP_GAMINGKB_STATIC	BIT(13)
+#define ACER_CAP_COUNT			14
 
 /*
  * Interface type flags
@@ -379,6 +496,22 @@ static u8 commun_fn_key_number;
 static u8 macro_key_state = 0;
 static bool cycle_gaming_thermal_profile = true;
 static bool predator_v4;
+static bool gkbbl_coalesce;
+static uint gkbbl_max_rate = 30;
+static bool gkbbl_write_through;
+static uint gkbbl_frame_late_us = 5000;
+static bool mock;
+static uint mock_latency_model;
+static uint mock_latency_us;
+static uint mock_latency_max_us = 10000;
+static uint record_kb = 256;
+static uint sensor_cache_ms = 100;
+static uint sensor_poll_ms;
+static uint sensor_poll_idle_ms = 10000;
+static uint thermal_poll_ms;
+static int thermal_passive = 90000;
+static int thermal_critical;
+static uint cmd_max_wait_ms = 200;
 
 module_param(mailled, int, 0444);
 module_param(brightness, int, 0444);
@@ -388,6 +521,22 @@ module_param(force_caps, int, 0444);
 module_param(ec_raw_mode, bool, 0444);
 module_param(cycle_gaming_thermal_profile, bool, 0644);
 module_param(predator_v4, bool, 0444);
+module_param(gkbbl_coalesce, bool, 0644);
+module_param(gkbbl_max_rate, uint, 0644);
+module_param(gkbbl_write_through, bool, 0644);
+module_param(gkbbl_frame_late_us, uint, 0644);
+module_param(mock, bool, 0444);
+module_param(mock_latency_model, uint, 0644);
+module_param(mock_latency_us, uint, 0644);
+module_param(mock_latency_max_us, uint, 0644);
+module_param(record_kb, uint, 0444);
+module_param(sensor_cache_ms, uint, 0644);
+module_param(sensor_poll_ms, uint, 0644);
+module_param(sensor_poll_idle_ms, uint, 0644);
+module_param(thermal_poll_ms, uint, 0444);
+module_param(thermal_passive, int, 0444);
+module_param(thermal_critical, int, 0444);
+module_param(cmd_max_wait_ms, uint, 0644);
 MODULE_PARM_DESC(mailled, "Set initial state of Mail LED");
 MODULE_PARM_DESC(brightness, "Set initial LCD backlight brightness");
 MODULE_PARM_DESC(threeg, "Set initial state of 3G hardware");
@@ -398,6 +547,38 @@ MODULE_PARM_DESC(cycle_gaming_thermal_profile,
 	"Set thermal mode key in cycle mode. Disabling it sets the mode key in turbo toggle mode");
 MODULE_PARM_DESC(predator_v4,
 	"Enable features for predator laptops that use predator sense v4");
+MODULE_PARM_DESC(gkbbl_coalesce,
+	"Coalesce keyboard backlight writes, only the newest pending config is applied");
+MODULE_PARM_DESC(gkbbl_max_rate,
+	"Maximum rate (Hz) at which coalesced keyboard backlight configs are applied, 0 for no limit");
+MODULE_PARM_DESC(gkbbl_write_through,
+	"Always send keyboard backlight configs to the firmware, even if unchanged");
+MODULE_PARM_DESC(gkbbl_frame_late_us,
+	"Queued keyboard backlight frames later than this (us) past their deadline are dropped");
+MODULE_PARM_DESC(mock,
+	"Use a simulated firmware instead of ACPI WMI and the EC, implies predator_v4 and turbo quirks");
+MODULE_PARM_DESC(mock_latency_model,
+	"Latency of simulated firmware calls: 0 fixed, 1 uniform, 2 heavy-tailed");
+MODULE_PARM_DESC(mock_latency_us,
+	"Simulated call latency (us), the lower bound for the uniform and heavy-tailed models");
+MODULE_PARM_DESC(mock_latency_max_us,
+	"Upper bound (us) of the uniform and heavy-tailed simulated call latency");
+MODULE_PARM_DESC(record_kb,
+	"Size (KiB) of the firmware traffic record ring and of the replay buffer");
+MODULE_PARM_DESC(sensor_cache_ms,
+	"Sensor values younger than this (ms) are served without a firmware call, 0 to only share calls in flight");
+MODULE_PARM_DESC(sensor_poll_ms,
+	"Sample the sensors in the background every this many ms and serve reads from the samples, 0 to disable");
+MODULE_PARM_DESC(sensor_poll_idle_ms,
+	"Stop the background sampler after this many ms without a sensor read");
+MODULE_PARM_DESC(thermal_poll_ms,
+	"Polling interval (ms) of the sensor thermal zones, 0 (default) to not register them");
+MODULE_PARM_DESC(thermal_passive,
+	"Passive trip point (millidegrees C) of the sensor thermal zones, 0 for none");
+MODULE_PARM_DESC(thermal_critical,
+	"Critical trip point (millidegrees C) of the sensor thermal zones, 0 for none");
+MODULE_PARM_DESC(cmd_max_wait_ms,
+	"Queued WMI calls waiting longer than this (ms) run ahead of higher priority ones, 0 to disable");
 
 #ifdef lts
 int platform_profile_remove()
@@ -677,6 +858,14 @@ static struct quirk_entry quirk_acer_predator_v4 = {
 	.predator_v4 = 1,
 };
 
+/* Everything the simulated firmware models */
+static struct quirk_entry quirk_acer_mock = {
+	.turbo = 1,
+	.cpu_fans = 1,
+	.gpu_fans = 1,
+	.predator_v4 = 1,
+};
+
 /* This AMW0 laptop has no bluetooth */
 static struct quirk_entry quirk_medion_md_98300 = {
 	.wireless = 1,
@@ -1276,7 +1465,9 @@ enum acer_predator_v4_thermal_profile_wmi {
 /* Find which quirks are needed for a particular vendor/ model pair */
 static void __init find_quirks(void)
 {
-	if (predator_v4) {
+	if (mock) {
+		quirks = &quirk_acer_mock;
+	} else if (predator_v4) {
 		quirks = &quirk_acer_predator_v4;
 	} else if (!force_series) {
 		dmi_check_system(acer_quirks);
@@ -1299,1079 +1490,4102 @@ static bool has_cap(u32 cap)
 }
 
 /*
- * AMW0 (V1) interface
+ * Simulated firmware
+ * With the mock parameter set, WMI methods, data blocks and EC accesses
+ * are answered by the model below instead of ACPI, so the driver can be
+ * exercised and benchmarked on any machine. It models the WMID, WMID v2
+ * and gaming methods the driver uses. Calls take the time chosen by the
+ * mock_latency_* parameters. Hotkey events are injected through debugfs.
  */
-struct wmab_args {
-	u32 eax;
-	u32 ebx;
-	u32 ecx;
-	u32 edx;
+enum acer_mock_latency_model {
+	ACER_MOCK_LAT_FIXED,
+	ACER_MOCK_LAT_UNIFORM,
+	ACER_MOCK_LAT_HEAVY,
 };
 
-struct wmab_ret {
-	u32 eax;
-	u32 ebx;
-	u32 ecx;
-	u32 edx;
-	u32 eex;
+#define ACER_MOCK_LATENCY_LIMIT_US	1000000
+
+/* GUID2 device bitmap: wireless, bluetooth, 3G and full brightness range */
+#define ACER_MOCK_WMID_DEVICES		0x77
+#define ACER_MOCK_SENSORS							\
+	(BIT(ACER_WMID_SENSOR_CPU_TEMPERATURE - 1) |				\
+	 BIT(ACER_WMID_SENSOR_CPU_FAN_SPEED - 1) |				\
+	 BIT(ACER_WMID_SENSOR_EXTERNAL_TEMPERATURE_2 - 1) |			\
+	 BIT(ACER_WMID_SENSOR_GPU_FAN_SPEED - 1) |				\
+	 BIT(ACER_WMID_SENSOR_GPU_TEMPERATURE - 1))
+
+enum acer_mock_wmid_value {
+	ACER_MOCK_WIRELESS,
+	ACER_MOCK_BLUETOOTH,
+	ACER_MOCK_BRIGHTNESS,
+	ACER_MOCK_THREEG,
+	ACER_MOCK_WMID_VALUES,
 };
 
-static acpi_status wmab_execute(struct wmab_args *regbuf,
-struct acpi_buffer *result)
+static struct {
+	spinlock_t lock;
+	u8 ec[256];
+	u32 wmid[ACER_MOCK_WMID_VALUES];
+	u16 devices;
+	u8 kbd_dock;
+	u8 kbbl[GAMING_KBBL_CONFIG_LEN];
+	u8 zones[GAMING_KBBL_STATIC_MAX_ZONES][3];
+	u64 gaming_led;
+	u64 fan_behavior;
+	u8 misc[256];
+
+	/* Sensor values, writable through debugfs */
+	u16 fan_rpm[2];
+	u8 cpu_temp;
+	u8 ext_temp;
+	u8 gpu_temp;
+	bool on_ac;
+} acer_mock = {
+	.lock = __SPIN_LOCK_UNLOCKED(acer_mock.lock),
+	.wmid = { 1, 1, 0xF, 0 },
+	.devices = ACER_WMID3_GDS_WIRELESS | ACER_WMID3_GDS_BLUETOOTH,
+	.kbd_dock = 0x01,
+	.misc = {
+		[ACER_WMID_MISC_SETTING_SUPPORTED_PROFILES] =
+			BIT(ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED) |
+			BIT(ACER_PREDATOR_V4_THERMAL_PROFILE_QUIET) |
+			BIT(ACER_PREDATOR_V4_THERMAL_PROFILE_PERFORMANCE) |
+			BIT(ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO) |
+			BIT(ACER_PREDATOR_V4_THERMAL_PROFILE_ECO),
+	},
+	.fan_rpm = { 2400, 2100 },
+	.cpu_temp = 55,
+	.ext_temp = 40,
+	.gpu_temp = 50,
+	.on_ac = true,
+};
+
+static void acer_mock_delay(void)
 {
-	struct acpi_buffer input;
-	acpi_status status;
-	input.length = sizeof(struct wmab_args);
-	input.pointer = (u8 *)regbuf;
+	u32 max = min_t(u32, READ_ONCE(mock_latency_max_us), ACER_MOCK_LATENCY_LIMIT_US);
+	u32 us = min_t(u32, READ_ONCE(mock_latency_us), ACER_MOCK_LATENCY_LIMIT_US);
 
-	status = wmi_evaluate_method(AMW0_GUID1, 0, 1, &input, result);
+	switch (READ_ONCE(mock_latency_model)) {
+	case ACER_MOCK_LAT_UNIFORM:
+		if (max > us)
+			us += get_random_u32() % (max - us + 1);
+		break;
+	case ACER_MOCK_LAT_HEAVY:
+		/* P(latency >= us * 2^k) = 2^-k, a Pareto tail with alpha 1 */
+		if (max > us)
+			us = min_t(u64, (u64)us << __ffs(get_random_u32() | BIT(31)), max);
+		break;
+	}
 
-	return status;
+	if (us)
+		fsleep(us);
 }
 
-static acpi_status AMW0_get_u32(u32 *value, u32 cap)
+/*
+ * Store a result like ACPI does: a buffer, or an integer given as 8 little
+ * endian bytes. There's no result if len is zero.
+ */
+static acpi_status acer_mock_reply(struct acpi_buffer *out, acpi_object_type type,
+				   const void *data, u32 len)
 {
-	int err;
-	u8 result;
+	union acpi_object *obj;
+	acpi_size size = sizeof(*obj);
 
-	switch (cap) {
-	case ACER_CAP_MAILLED:
-		switch (quirks->mailled) {
-		default:
-			err = ec_read(0xA, &result);
-			if (err)
-				return AE_ERROR;
-			*value = (result >> 7) & 0x1;
-			return AE_OK;
-		}
+	if (!out)
+		return AE_OK;
+
+	if (!len || (type == ACPI_TYPE_INTEGER && len < sizeof(u64))) {
+		out->length = 0;
+		return AE_OK;
+	}
+
+	if (type == ACPI_TYPE_BUFFER)
+		size += len;
+
+	if (out->length == ACPI_ALLOCATE_BUFFER) {
+		out->pointer = kzalloc(size, GFP_KERNEL);
+		if (!out->pointer)
+			return AE_NO_MEMORY;
+	} else if (out->length < size) {
+		out->length = size;
+		return AE_BUFFER_OVERFLOW;
+	}
+	out->length = size;
+
+	obj = out->pointer;
+	obj->type = type;
+	if (type == ACPI_TYPE_INTEGER) {
+		obj->integer.value = get_unaligned_le64(data);
+	} else {
+		obj->buffer.length = len;
+		obj->buffer.pointer = (u8 *)(obj + 1);
+		memcpy(obj->buffer.pointer, data, len);
+	}
+
+	return AE_OK;
+}
+
+static const u8 *acer_mock_input(const struct acpi_buffer *in, u32 len)
+{
+	if (!in || !in->pointer || in->length < len)
+		return NULL;
+
+	return in->pointer;
+}
+
+static acpi_status acer_mock_wmid(u32 method_id, const struct acpi_buffer *in,
+				  u8 *reply, u32 *len)
+{
+	const u8 *input = acer_mock_input(in, sizeof(u32));
+	u32 *value;
+
+	if (!input)
+		return AE_BAD_PARAMETER;
+
+	switch (method_id) {
+	case ACER_WMID_GET_WIRELESS_METHODID:
+	case ACER_WMID_SET_WIRELESS_METHODID:
+		value = &acer_mock.wmid[ACER_MOCK_WIRELESS];
 		break;
-	case ACER_CAP_WIRELESS:
-		switch (quirks->wireless) {
-		case 1:
-			err = ec_read(0x7B, &result);
-			if (err)
-				return AE_ERROR;
-			*value = result & 0x1;
-			return AE_OK;
-		case 2:
-			err = ec_read(0x71, &result);
-			if (err)
-				return AE_ERROR;
-			*value = result & 0x1;
-			return AE_OK;
-		case 3:
-			err = ec_read(0x78, &result);
-			if (err)
-				return AE_ERROR;
-			*value = result & 0x1;
-			return AE_OK;
-		default:
-			err = ec_read(0xA, &result);
-			if (err)
-				return AE_ERROR;
-			*value = (result >> 2) & 0x1;
-			return AE_OK;
-		}
+	case ACER_WMID_GET_BLUETOOTH_METHODID:
+	case ACER_WMID_SET_BLUETOOTH_METHODID:
+		value = &acer_mock.wmid[ACER_MOCK_BLUETOOTH];
 		break;
-	case ACER_CAP_BLUETOOTH:
-		switch (quirks->bluetooth) {
-		default:
-			err = ec_read(0xA, &result);
-			if (err)
-				return AE_ERROR;
-			*value = (result >> 4) & 0x1;
-			return AE_OK;
-		}
+	case ACER_WMID_GET_BRIGHTNESS_METHODID:
+	case ACER_WMID_SET_BRIGHTNESS_METHODID:
+		value = &acer_mock.wmid[ACER_MOCK_BRIGHTNESS];
 		break;
-	case ACER_CAP_BRIGHTNESS:
-		switch (quirks->brightness) {
-		default:
-			err = ec_read(0x83, &result);
-			if (err)
-				return AE_ERROR;
-			*value = result;
-			return AE_OK;
-		}
+	case ACER_WMID_GET_THREEG_METHODID:
+	case ACER_WMID_SET_THREEG_METHODID:
+		value = &acer_mock.wmid[ACER_MOCK_THREEG];
 		break;
 	default:
-		return AE_ERROR;
+		return AE_NOT_FOUND;
+	}
+
+	switch (method_id) {
+	case ACER_WMID_SET_WIRELESS_METHODID:
+	case ACER_WMID_SET_BLUETOOTH_METHODID:
+	case ACER_WMID_SET_BRIGHTNESS_METHODID:
+	case ACER_WMID_SET_THREEG_METHODID:
+		*value = get_unaligned_le32(input);
+		break;
+	default:
+		put_unaligned_le32(*value, reply);
+		*len = sizeof(u32);
+		break;
 	}
+
 	return AE_OK;
 }
 
-static acpi_status AMW0_set_u32(u32 value, u32 cap)
+/* WMID v2 device status, function mode and keyboard dock methods */
+static acpi_status acer_mock_wmid3(u32 method_id, const struct acpi_buffer *in,
+				   u8 *reply, u32 *len)
 {
-	struct wmab_args args;
+	const u8 *input = acer_mock_input(in, 1);
 
-	args.eax = ACER_AMW0_WRITE;
-	args.ebx = value ? (1<<8) : 0;
-	args.ecx = args.edx = 0;
+	if (!input)
+		return AE_BAD_PARAMETER;
 
-	switch (cap) {
-	case ACER_CAP_MAILLED:
-		if (value > 1)
+	switch (method_id) {
+	case 0x1:
+		/* Set function mode, or set device status */
+		if (input[0] == 0x2) {
+			input = acer_mock_input(in, sizeof(struct wmid3_gds_set_input_param));
+			if (!input)
+				return AE_BAD_PARAMETER;
+			acer_mock.devices = get_unaligned_le16(input + 2);
+		}
+		*len = sizeof(struct func_return_value);
+		return AE_OK;
+	case 0x2:
+		/* Get device status, or the keyboard dock state */
+		if (input[0] == 0x05) {
+			reply[3] = 0x05;
+			reply[4] = acer_mock.kbd_dock;
+		} else {
+			put_unaligned_le16(acer_mock.devices, reply + 2);
+		}
+		*len = sizeof(struct wmid3_gds_return_value);
+		return AE_OK;
+	default:
+		return AE_NOT_FOUND;
+	}
+}
+
+static u64 acer_mock_sys_info(u64 command)
+{
+	u8 index = FIELD_GET(ACER_PREDATOR_V4_SENSOR_INDEX_BIT_MASK, command);
+	u16 reading;
+
+	switch (command & 0xFF) {
+	case 0x00:
+		return FIELD_PREP(ACER_PREDATOR_V4_SUPPORTED_SENSORS_BIT_MASK,
+				  ACER_MOCK_SENSORS);
+	case 0x01:
+		switch (index) {
+		case ACER_WMID_SENSOR_CPU_TEMPERATURE:
+			reading = acer_mock.cpu_temp;
+			break;
+		case ACER_WMID_SENSOR_CPU_FAN_SPEED:
+			reading = acer_mock.fan_rpm[0];
+			break;
+		case ACER_WMID_SENSOR_EXTERNAL_TEMPERATURE_2:
+			reading = acer_mock.ext_temp;
+			break;
+		case ACER_WMID_SENSOR_GPU_FAN_SPEED:
+			reading = acer_mock.fan_rpm[1];
+			break;
+		case ACER_WMID_SENSOR_GPU_TEMPERATURE:
+			reading = acer_mock.gpu_temp;
+			break;
+		default:
+			/* Unsupported sensor */
+			return FIELD_PREP(ACER_PREDATOR_V4_RETURN_STATUS_BIT_MASK, 0x01);
+		}
+		return FIELD_PREP(ACER_PREDATOR_V4_SENSOR_READING_BIT_MASK, reading);
+	case ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS:
+		return acer_mock.on_ac;
+	default:
+		return FIELD_PREP(ACER_PREDATOR_V4_RETURN_STATUS_BIT_MASK, 0x01);
+	}
+}
+
+static acpi_status acer_mock_gaming(u32 method_id, const struct acpi_buffer *in,
+				    u8 *reply, u32 *len)
+{
+	const u8 *input = acer_mock_input(in, sizeof(u32));
+	u64 value = 0;
+	u8 index;
+	int i;
+
+	if (!input)
+		return AE_BAD_PARAMETER;
+
+	/* Methods taking a u32, a zone record or a config */
+	switch (method_id) {
+	case ACER_WMID_SET_GAMINGKBBL_METHODID:
+		input = acer_mock_input(in, GAMING_KBBL_CONFIG_LEN);
+		if (!input)
 			return AE_BAD_PARAMETER;
-		args.ebx |= ACER_AMW0_MAILLED_MASK;
+		memcpy(acer_mock.kbbl, input, GAMING_KBBL_CONFIG_LEN);
+		return AE_OK;
+	case ACER_WMID_GET_GAMINGKBBL_METHODID:
+		memcpy(reply, acer_mock.kbbl, GAMING_KBBL_CONFIG_LEN);
+		*len = GAMING_KBBL_CONFIG_LEN;
+		return AE_OK;
+	case ACER_WMID_SET_GAMING_STATIC_LED_METHODID:
+		for (i = 0; i < GAMING_KBBL_STATIC_MAX_ZONES; i++) {
+			if (input[0] & BIT(i))
+				memcpy(acer_mock.zones[i], input + 1, 3);
+		}
+		return AE_OK;
+	case ACER_WMID_GET_GAMING_MISC_SETTING_METHODID:
+		index = FIELD_GET(ACER_GAMING_MISC_SETTING_INDEX_MASK,
+				  get_unaligned_le32(input));
+		value = FIELD_PREP(ACER_GAMING_MISC_SETTING_VALUE_MASK,
+				   acer_mock.misc[index]);
+		goto out;
+	}
+
+	/* The others take a u64 */
+	input = acer_mock_input(in, sizeof(u64));
+	if (!input)
+		return AE_BAD_PARAMETER;
+
+	switch (method_id) {
+	case ACER_WMID_SET_GAMING_LED_METHODID:
+		acer_mock.gaming_led = get_unaligned_le64(input);
 		break;
-	case ACER_CAP_WIRELESS:
-		if (value > 1)
-			return AE_BAD_PARAMETER;
-		args.ebx |= ACER_AMW0_WIRELESS_MASK;
+	case ACER_WMID_GET_GAMING_LED_METHODID:
+		value = acer_mock.gaming_led;
 		break;
-	case ACER_CAP_BLUETOOTH:
-		if (value > 1)
-			return AE_BAD_PARAMETER;
-		args.ebx |= ACER_AMW0_BLUETOOTH_MASK;
+	case ACER_WMID_SET_GAMING_FAN_BEHAVIOR:
+		acer_mock.fan_behavior = get_unaligned_le64(input);
+		break;
+	case ACER_WMID_GET_GAMING_SYS_INFO_METHODID:
+		value = acer_mock_sys_info(get_unaligned_le64(input));
+		break;
+	case ACER_WMID_SET_GAMING_MISC_SETTING_METHODID:
+		value = get_unaligned_le64(input);
+		index = FIELD_GET(ACER_GAMING_MISC_SETTING_INDEX_MASK, value);
+		acer_mock.misc[index] = FIELD_GET(ACER_GAMING_MISC_SETTING_VALUE_MASK, value);
+		if (index == ACER_WMID_MISC_SETTING_PLATFORM_PROFILE)
+			acer_mock.ec[ACER_PREDATOR_V4_THERMAL_PROFILE_EC_OFFSET] =
+				acer_mock.misc[index];
+		value = 0;
 		break;
-	case ACER_CAP_BRIGHTNESS:
-		if (value > max_brightness)
-			return AE_BAD_PARAMETER;
-		switch (quirks->brightness) {
-		default:
-			return ec_write(0x83, value);
-		}
 	default:
-		return AE_ERROR;
+		return AE_NOT_FOUND;
 	}
 
-	/* Actually do the set */
-	return wmab_execute(&args, NULL);
+out:
+	put_unaligned_le64(value, reply);
+	*len = sizeof(u64);
+	return AE_OK;
 }
 
-static acpi_status __init AMW0_find_mailled(void)
+static acpi_status acer_mock_evaluate(const char *guid, u32 method_id,
+				      const struct acpi_buffer *in,
+				      struct acpi_buffer *out)
 {
-	struct wmab_args args;
-	struct wmab_ret ret;
-	acpi_status status = AE_OK;
-	struct acpi_buffer out = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *obj;
+	u8 reply[GAMING_KBBL_CONFIG_LEN] = {};
+	acpi_status status;
+	u32 len = 0;
 
-	args.eax = 0x86;
-	args.ebx = args.ecx = args.edx = 0;
+	acer_mock_delay();
+
+	spin_lock(&acer_mock.lock);
+	if (!strcmp(guid, WMID_GUID1))
+		status = acer_mock_wmid(method_id, in, reply, &len);
+	else if (!strcmp(guid, WMID_GUID3))
+		status = acer_mock_wmid3(method_id, in, reply, &len);
+	else if (!strcmp(guid, WMID_GUID4))
+		status = acer_mock_gaming(method_id, in, reply, &len);
+	else
+		status = AE_NOT_EXIST;
+	spin_unlock(&acer_mock.lock);
 
-	status = wmab_execute(&args, &out);
 	if (ACPI_FAILURE(status))
 		return status;
 
-	obj = (union acpi_object *) out.pointer;
-	if (obj && obj->type == ACPI_TYPE_BUFFER &&
-	obj->buffer.length == sizeof(struct wmab_ret)) {
-		ret = *((struct wmab_ret *) obj->buffer.pointer);
-	} else {
-		kfree(out.pointer);
-		return AE_ERROR;
-	}
+	return acer_mock_reply(out, ACPI_TYPE_BUFFER, reply, len);
+}
 
-	if (ret.eex & 0x1)
-		interface->capability |= ACER_CAP_MAILLED;
+static acpi_status acer_mock_query(const char *guid, struct acpi_buffer *out)
+{
+	u8 reply[sizeof(u32)];
 
-	kfree(out.pointer);
+	acer_mock_delay();
 
-	return AE_OK;
-}
+	if (strcmp(guid, WMID_GUID2))
+		return AE_NOT_EXIST;
 
-static const struct acpi_device_id norfkill_ids[] __initconst = {
-	{ "VPC2004", 0},
-	{ "IBM0068", 0},
-	{ "LEN0068", 0},
-	{ "SNY5001", 0},	/* sony-laptop in charge */
-	{ "HPQ6601", 0},
-	{ "", 0},
-};
+	put_unaligned_le32(ACER_MOCK_WMID_DEVICES, reply);
+	return acer_mock_reply(out, ACPI_TYPE_BUFFER, reply, sizeof(reply));
+}
 
-static int __init AMW0_set_cap_acpi_check_device(void)
+static int acer_mock_ec_read(u8 addr, u8 *val)
 {
-	const struct acpi_device_id *id;
+	acer_mock_delay();
 
-	for (id = norfkill_ids; id->id[0]; id++)
-		if (acpi_dev_found(id->id))
-			return true;
+	spin_lock(&acer_mock.lock);
+	*val = acer_mock.ec[addr];
+	spin_unlock(&acer_mock.lock);
 
-	return false;
+	return 0;
 }
 
-static acpi_status __init AMW0_set_capabilities(void)
+static int acer_mock_ec_write(u8 addr, u8 val)
 {
-	struct wmab_args args;
-	struct wmab_ret ret;
-	acpi_status status;
-	struct acpi_buffer out = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *obj;
+	acer_mock_delay();
 
-	/*
-	 * On laptops with this strange GUID (non Acer), normal probing doesn't
-	 * work.
-	 */
-	if (wmi_has_guid(AMW0_GUID2)) {
-		if ((quirks != &quirk_unknown) ||
-		    !AMW0_set_cap_acpi_check_device())
-			interface->capability |= ACER_CAP_WIRELESS;
-		return AE_OK;
-	}
+	spin_lock(&acer_mock.lock);
+	acer_mock.ec[addr] = val;
+	spin_unlock(&acer_mock.lock);
 
-	args.eax = ACER_AMW0_WRITE;
-	args.ecx = args.edx = 0;
+	return 0;
+}
 
-	args.ebx = 0xa2 << 8;
-	args.ebx |= ACER_AMW0_WIRELESS_MASK;
+/*
+ * WMI GUIDs present on this machine, looked up once on load
+ */
+enum acer_guid {
+	ACER_GUID_AMW0_1,
+	ACER_GUID_AMW0_2,
+	ACER_GUID_WMID_1,
+	ACER_GUID_WMID_2,
+	ACER_GUID_WMID_3,
+	ACER_GUID_WMID_4,
+	ACER_GUID_EVENT,
+	ACER_GUID_COUNT,
+};
 
-	status = wmab_execute(&args, &out);
-	if (ACPI_FAILURE(status))
-		return status;
+static const char * const acer_guid_strings[ACER_GUID_COUNT] = {
+	[ACER_GUID_AMW0_1] = AMW0_GUID1,
+	[ACER_GUID_AMW0_2] = AMW0_GUID2,
+	[ACER_GUID_WMID_1] = WMID_GUID1,
+	[ACER_GUID_WMID_2] = WMID_GUID2,
+	[ACER_GUID_WMID_3] = WMID_GUID3,
+	[ACER_GUID_WMID_4] = WMID_GUID4,
+	[ACER_GUID_EVENT] = ACERWMID_EVENT_GUID,
+};
 
-	obj = out.pointer;
-	if (obj && obj->type == ACPI_TYPE_BUFFER &&
-	obj->buffer.length == sizeof(struct wmab_ret)) {
-		ret = *((struct wmab_ret *) obj->buffer.pointer);
-	} else {
-		status = AE_ERROR;
-		goto out;
+static u32 acer_guids;
+
+static void __init acer_guids_init(void)
+{
+	int i;
+
+	if (mock) {
+		acer_guids = BIT(ACER_GUID_WMID_1) | BIT(ACER_GUID_WMID_2) |
+			     BIT(ACER_GUID_WMID_3) | BIT(ACER_GUID_WMID_4) |
+			     BIT(ACER_GUID_EVENT);
+		return;
 	}
 
-	if (ret.eax & 0x1)
-		interface->capability |= ACER_CAP_WIRELESS;
+	for (i = 0; i < ACER_GUID_COUNT; i++) {
+		if (wmi_has_guid(acer_guid_strings[i]))
+			acer_guids |= BIT(i);
+	}
+}
 
-	args.ebx = 2 << 8;
-	args.ebx |= ACER_AMW0_BLUETOOTH_MASK;
+static bool has_guid(enum acer_guid guid)
+{
+	return acer_guids & BIT(guid);
+}
 
-	/*
-	 * It's ok to use existing buffer for next wmab_execute call.
-	 * But we need to kfree(out.pointer) if next wmab_execute fail.
-	 */
-	status = wmab_execute(&args, &out);
-	if (ACPI_FAILURE(status))
+/*
+ * Firmware traffic recording and replay
+ * While recording, every WMI method call, block query, EC access and WMI
+ * event is appended to a ring as a struct acer_rec followed by its input
+ * and output bytes. debugfs reads consume the ring. A captured trace can
+ * be written back and replayed: its records then answer the firmware
+ * calls in place of ACPI, at full speed or taking the recorded durations,
+ * and its events are fed to the event handler.
+ */
+enum acer_rec_type {
+	ACER_REC_METHOD = 1,
+	ACER_REC_QUERY,
+	ACER_REC_EC_READ,
+	ACER_REC_EC_WRITE,
+	ACER_REC_EVENT,
+};
+
+enum acer_rec_out {
+	ACER_REC_OUT_NONE,
+	ACER_REC_OUT_INTEGER,
+	ACER_REC_OUT_BUFFER,
+};
+
+/*
+ * Header of a record, all fields are little endian. The GUID is stored
+ * itself, in guid_t byte order, so traces don't depend on the driver's
+ * GUID numbering.
+ */
+struct acer_rec {
+	__le64 time_ns;		/* Since recording started */
+	__le32 duration_ns;
+	__le32 id;		/* Method ID, EC address or event function */
+	__le32 status;		/* acpi_status, or errno of EC accesses */
+	u8 type;		/* enum acer_rec_type */
+	u8 out_type;		/* enum acer_rec_out */
+	__le16 in_len;
+	__le16 out_len;
+	__le16 reserved;
+	guid_t guid;		/* All zero for EC accesses */
+} __packed;
+
+static struct {
+	spinlock_t lock;	/* Writers */
+	struct mutex read_lock;
+	bool enabled;
+	u64 start_ns;
+	u64 records;
+	u64 dropped;
+	DECLARE_KFIFO_PTR(ring, u8);
+} acer_rec = {
+	.lock = __SPIN_LOCK_UNLOCKED(acer_rec.lock),
+	.read_lock = __MUTEX_INITIALIZER(acer_rec.read_lock),
+};
+
+static void acer_replay_event_work(struct work_struct *work);
+
+struct acer_replay_rec {
+	const struct acer_rec *rec;
+	const u8 *in;
+	const u8 *out;
+	bool used;
+};
+
+static struct {
+	struct mutex lock;		/* Control and trace loading */
+	struct rw_semaphore trace_sem;	/* Trace lifetime against users */
+	spinlock_t match_lock;
+	bool active;
+	bool realtime;
+	u8 *buf;
+	size_t size;
+	size_t len;
+	struct acer_replay_rec *recs;
+	unsigned int nr;
+	unsigned int first_unused;
+	unsigned int next_event;
+	u64 start_ns;
+	u64 hits;
+	u64 misses;
+	struct delayed_work event_work;
+} acer_replay = {
+	.lock = __MUTEX_INITIALIZER(acer_replay.lock),
+	.trace_sem = __RWSEM_INITIALIZER(acer_replay.trace_sem),
+	.match_lock = __SPIN_LOCK_UNLOCKED(acer_replay.match_lock),
+	.event_work = __DELAYED_WORK_INITIALIZER(acer_replay.event_work,
+						 acer_replay_event_work, 0),
+};
+
+static void acer_rec_guid(const char *str, guid_t *guid)
+{
+	if (guid_parse(str, guid))
+		*guid = guid_null;
+}
+
+static void acer_rec_add(struct acer_rec *rec, u64 start_ns,
+			 const void *in, u32 in_len, const void *out, u32 out_len)
+{
+	in_len = min_t(u32, in_len, U16_MAX);
+	out_len = min_t(u32, out_len, U16_MAX);
+	rec->in_len = cpu_to_le16(in_len);
+	rec->out_len = cpu_to_le16(out_len);
+
+	spin_lock(&acer_rec.lock);
+	if (!acer_rec.enabled)
 		goto out;
 
-	obj = (union acpi_object *) out.pointer;
-	if (obj && obj->type == ACPI_TYPE_BUFFER
-	&& obj->buffer.length == sizeof(struct wmab_ret)) {
-		ret = *((struct wmab_ret *) obj->buffer.pointer);
-	} else {
-		status = AE_ERROR;
+	if (kfifo_avail(&acer_rec.ring) < sizeof(*rec) + in_len + out_len) {
+		acer_rec.dropped++;
 		goto out;
 	}
 
-	if (ret.eax & 0x1)
-		interface->capability |= ACER_CAP_BLUETOOTH;
+	rec->time_ns = cpu_to_le64(start_ns > acer_rec.start_ns ?
+				   start_ns - acer_rec.start_ns : 0);
+	kfifo_in(&acer_rec.ring, (u8 *)rec, sizeof(*rec));
+	kfifo_in(&acer_rec.ring, in, in_len);
+	kfifo_in(&acer_rec.ring, out, out_len);
+	acer_rec.records++;
+out:
+	spin_unlock(&acer_rec.lock);
+}
 
-	/*
-	 * This appears to be safe to enable, since all Wistron based laptops
-	 * appear to use the same EC register for brightness, even if they
-	 * differ for wireless, etc
-	 */
-	if (quirks->brightness >= 0)
-		interface->capability |= ACER_CAP_BRIGHTNESS;
+static void acer_rec_wmi(enum acer_rec_type type, const char *guid, u32 id,
+			 const struct acpi_buffer *in, acpi_status status,
+			 const struct acpi_buffer *out, u64 start_ns, u64 duration)
+{
+	struct acer_rec rec = {
+		.duration_ns = cpu_to_le32(min_t(u64, duration, U32_MAX)),
+		.id = cpu_to_le32(id),
+		.status = cpu_to_le32(status),
+		.type = type,
+	};
+	const union acpi_object *obj = NULL;
+	const void *out_data = NULL;
+	u32 out_len = 0;
+	__le64 value;
 
-	status = AE_OK;
-out:
-	kfree(out.pointer);
-	return status;
+	if (!READ_ONCE(acer_rec.enabled))
+		return;
+
+	acer_rec_guid(guid, &rec.guid);
+
+	if (ACPI_SUCCESS(status) && out && out->pointer && out->length)
+		obj = out->pointer;
+
+	if (obj && obj->type == ACPI_TYPE_INTEGER) {
+		value = cpu_to_le64(obj->integer.value);
+		rec.out_type = ACER_REC_OUT_INTEGER;
+		out_data = &value;
+		out_len = sizeof(value);
+	} else if (obj && obj->type == ACPI_TYPE_BUFFER) {
+		rec.out_type = ACER_REC_OUT_BUFFER;
+		out_data = obj->buffer.pointer;
+		out_len = obj->buffer.length;
+	}
+
+	acer_rec_add(&rec, start_ns, in ? in->pointer : NULL, in ? in->length : 0,
+		     out_data, out_len);
 }
 
-static struct wmi_interface AMW0_interface = {
-	.type = ACER_AMW0,
-};
+static void acer_rec_ec(enum acer_rec_type type, u8 addr, u8 val, int err,
+			u64 start_ns, u64 duration)
+{
+	struct acer_rec rec = {
+		.duration_ns = cpu_to_le32(min_t(u64, duration, U32_MAX)),
+		.id = cpu_to_le32(addr),
+		.status = cpu_to_le32(err),
+		.type = type,
+	};
 
-static struct wmi_interface AMW0_V2_interface = {
-	.type = ACER_AMW0_V2,
-};
+	if (!READ_ONCE(acer_rec.enabled))
+		return;
+
+	if (type == ACER_REC_EC_WRITE) {
+		acer_rec_add(&rec, start_ns, &val, sizeof(val), NULL, 0);
+	} else {
+		rec.out_type = err ? ACER_REC_OUT_NONE : ACER_REC_OUT_BUFFER;
+		acer_rec_add(&rec, start_ns, NULL, 0, &val, err ? 0 : sizeof(val));
+	}
+}
 
 /*
- * New interface (The WMID interface)
+ * The next unused record of this call, preferring one with the same input.
+ * Called with match_lock held.
  */
-static acpi_status
-WMI_execute_u32(u32 method_id, u32 in, u32 *out)
+static struct acer_replay_rec *acer_replay_match(enum acer_rec_type type,
+						 const guid_t *guid, u32 id,
+						 const void *in, u32 in_len)
 {
-	struct acpi_buffer input = { (acpi_size) sizeof(u32), (void *)(&in) };
-	struct acpi_buffer result = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *obj;
-	u32 tmp = 0;
-	acpi_status status;
+	struct acer_replay_rec *fallback = NULL, *r;
+	unsigned int i;
+
+	while (acer_replay.first_unused < acer_replay.nr &&
+	       acer_replay.recs[acer_replay.first_unused].used)
+		acer_replay.first_unused++;
+
+	for (i = acer_replay.first_unused; i < acer_replay.nr; i++) {
+		r = &acer_replay.recs[i];
+		if (r->used || r->rec->type != type || !guid_equal(&r->rec->guid, guid) ||
+		    le32_to_cpu(r->rec->id) != id)
+			continue;
+
+		if (le16_to_cpu(r->rec->in_len) == in_len &&
+		    (!in_len || !memcmp(r->in, in, in_len)))
+			return r;
+		if (!fallback)
+			fallback = r;
+	}
 
-	status = wmi_evaluate_method(WMID_GUID1, 0, method_id, &input, &result);
+	return fallback;
+}
 
-	if (ACPI_FAILURE(status))
-		return status;
+/* Take the next matching record, with trace_sem held for reading */
+static struct acer_replay_rec *acer_replay_take(enum acer_rec_type type,
+						const guid_t *guid, u32 id,
+						const void *in, u32 in_len)
+{
+	struct acer_replay_rec *r;
 
-	obj = (union acpi_object *) result.pointer;
-	if (obj) {
-		if (obj->type == ACPI_TYPE_BUFFER &&
-			(obj->buffer.length == sizeof(u32) ||
-			obj->buffer.length == sizeof(u64))) {
-			tmp = *((u32 *) obj->buffer.pointer);
-		} else if (obj->type == ACPI_TYPE_INTEGER) {
-			tmp = (u32) obj->integer.value;
-		}
+	spin_lock(&acer_replay.match_lock);
+	r = acer_replay_match(type, guid, id, in, in_len);
+	if (r) {
+		r->used = true;
+		acer_replay.hits++;
+	} else {
+		acer_replay.misses++;
 	}
+	spin_unlock(&acer_replay.match_lock);
 
-	if (out)
-		*out = tmp;
+	if (r && READ_ONCE(acer_replay.realtime))
+		fsleep(div_u64(le32_to_cpu(r->rec->duration_ns), NSEC_PER_USEC));
 
-	kfree(result.pointer);
-
-	return status;
+	return r;
 }
 
-static acpi_status WMID_get_u32(u32 *value, u32 cap)
+static acpi_status acer_replay_call(enum acer_rec_type type, const char *guid,
+				    u32 id, const struct acpi_buffer *in,
+				    struct acpi_buffer *out)
 {
+	struct acer_replay_rec *r;
+	acpi_object_type out_type;
 	acpi_status status;
-	u8 tmp;
-	u32 result, method_id = 0;
+	guid_t guid_bin;
 
-	switch (cap) {
-	case ACER_CAP_WIRELESS:
-		method_id = ACER_WMID_GET_WIRELESS_METHODID;
-		break;
-	case ACER_CAP_BLUETOOTH:
-		method_id = ACER_WMID_GET_BLUETOOTH_METHODID;
-		break;
-	case ACER_CAP_BRIGHTNESS:
-		method_id = ACER_WMID_GET_BRIGHTNESS_METHODID;
+	acer_rec_guid(guid, &guid_bin);
+
+	down_read(&acer_replay.trace_sem);
+	r = acer_replay_take(type, &guid_bin, id,
+			     in ? in->pointer : NULL, in ? in->length : 0);
+	if (!r) {
+		status = AE_NOT_FOUND;
+		goto out;
+	}
+
+	status = le32_to_cpu(r->rec->status);
+	if (ACPI_FAILURE(status))
+		goto out;
+
+	switch (r->rec->out_type) {
+	case ACER_REC_OUT_INTEGER:
+		out_type = ACPI_TYPE_INTEGER;
 		break;
-	case ACER_CAP_THREEG:
-		method_id = ACER_WMID_GET_THREEG_METHODID;
+	case ACER_REC_OUT_BUFFER:
+		out_type = ACPI_TYPE_BUFFER;
 		break;
-	case ACER_CAP_MAILLED:
-		if (quirks->mailled == 1) {
-			ec_read(0x9f, &tmp);
-			*value = tmp & 0x1;
-			return 0;
-		}
-		fallthrough;
 	default:
-		return AE_ERROR;
+		out_type = ACPI_TYPE_ANY;
+		break;
 	}
-	status = WMI_execute_u32(method_id, 0, &result);
+	/*
+	 * An overflow of an inline result buffer fails the call like real
+	 * firmware would, the record stays consumed
+	 */
+	status = acer_mock_reply(out, out_type, r->out,
+				 out_type == ACPI_TYPE_ANY ? 0 : le16_to_cpu(r->rec->out_len));
+out:
+	up_read(&acer_replay.trace_sem);
+	return status;
+}
 
-	if (ACPI_SUCCESS(status))
-		*value = (u8)result;
+static int acer_replay_ec(enum acer_rec_type type, u8 addr, u8 *val)
+{
+	struct acer_replay_rec *r;
+	int err = -ENODATA;
+
+	down_read(&acer_replay.trace_sem);
+	r = acer_replay_take(type, &guid_null, addr,
+			     type == ACER_REC_EC_WRITE ? val : NULL,
+			     type == ACER_REC_EC_WRITE ? sizeof(*val) : 0);
+	if (r) {
+		err = (s32)le32_to_cpu(r->rec->status);
+		if (type == ACER_REC_EC_READ && !err && le16_to_cpu(r->rec->out_len))
+			*val = r->out[0];
+	}
+	up_read(&acer_replay.trace_sem);
 
-	return status;
+	return err;
 }
 
-static acpi_status WMID_set_u32(u32 value, u32 cap)
+/*
+ * Firmware call latency
+ * Every WMI method, WMI block query and EC access is timed and added to a
+ * log2 histogram keyed by GUID and method ID, or by EC address for EC
+ * accesses. The histograms are exported in debugfs.
+ */
+#define ACER_LAT_BUCKETS 32		/* Bucket n counts calls < 2^n ns */
+#define ACER_LAT_MAX_ENTRIES 48
+#define ACER_LAT_QUERY U32_MAX		/* Method ID of block queries */
+#define ACER_LAT_EC_READ "EC_READ"
+#define ACER_LAT_EC_WRITE "EC_WRITE"
+
+struct acer_lat_entry {
+	const char *guid;
+	u32 method_id;
+	u64 count;
+	u64 total_ns;
+	u64 min_ns;
+	u64 max_ns;
+	u64 buckets[ACER_LAT_BUCKETS];
+};
+
+static struct acer_lat_data {
+	spinlock_t lock;
+	unsigned int nr_entries;
+	u64 dropped;	/* Calls not recorded because the table was full */
+	struct acer_lat_entry entries[ACER_LAT_MAX_ENTRIES];
+} acer_lat = {
+	.lock = __SPIN_LOCK_UNLOCKED(acer_lat.lock),
+};
+
+static void acer_lat_record(const char *guid, u32 method_id, u64 delta)
 {
-	u32 method_id = 0;
-	char param;
+	struct acer_lat_entry *entry = NULL;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&acer_lat.lock, flags);
+	for (i = 0; i < acer_lat.nr_entries; i++) {
+		if (acer_lat.entries[i].method_id == method_id &&
+		    !strcmp(acer_lat.entries[i].guid, guid)) {
+			entry = &acer_lat.entries[i];
+			break;
+		}
+	}
 
-	switch (cap) {
-	case ACER_CAP_BRIGHTNESS:
-		if (value > max_brightness)
-			return AE_BAD_PARAMETER;
-		method_id = ACER_WMID_SET_BRIGHTNESS_METHODID;
-		break;
-	case ACER_CAP_WIRELESS:
-		if (value > 1)
-			return AE_BAD_PARAMETER;
-		method_id = ACER_WMID_SET_WIRELESS_METHODID;
-		break;
-	case ACER_CAP_BLUETOOTH:
-		if (value > 1)
-			return AE_BAD_PARAMETER;
-		method_id = ACER_WMID_SET_BLUETOOTH_METHODID;
-		break;
-	case ACER_CAP_THREEG:
-		if (value > 1)
-			return AE_BAD_PARAMETER;
-		method_id = ACER_WMID_SET_THREEG_METHODID;
-		break;
-	case ACER_CAP_MAILLED:
-		if (value > 1)
-			return AE_BAD_PARAMETER;
-		if (quirks->mailled == 1) {
-			param = value ? 0x92 : 0x93;
-			i8042_lock_chip();
-			i8042_command(&param, 0x1059);
-			i8042_unlock_chip();
-			return 0;
+	if (!entry) {
+		if (acer_lat.nr_entries == ACER_LAT_MAX_ENTRIES) {
+			acer_lat.dropped++;
+			goto out;
 		}
-		break;
-	default:
-		return AE_ERROR;
+		entry = &acer_lat.entries[acer_lat.nr_entries++];
+		entry->guid = guid;
+		entry->method_id = method_id;
+		entry->min_ns = U64_MAX;
 	}
-	return WMI_execute_u32(method_id, (u32)value, NULL);
+
+	entry->count++;
+	entry->total_ns += delta;
+	entry->min_ns = min(entry->min_ns, delta);
+	entry->max_ns = max(entry->max_ns, delta);
+	entry->buckets[min_t(unsigned int, fls64(delta), ACER_LAT_BUCKETS - 1)]++;
+out:
+	spin_unlock_irqrestore(&acer_lat.lock, flags);
 }
 
-static acpi_status wmid3_get_device_status(u32 *value, u16 device)
+static acpi_status acer_wmi_call(const char *guid, u8 instance, u32 method_id,
+				 const struct acpi_buffer *in, struct acpi_buffer *out)
 {
-	struct wmid3_gds_return_value return_value;
 	acpi_status status;
-	union acpi_object *obj;
-	struct wmid3_gds_get_input_param params = {
-		.function_num = 0x1,
-		.hotkey_number = commun_fn_key_number,
-		.devices = device,
-	};
-	struct acpi_buffer input = {
-		sizeof(struct wmid3_gds_get_input_param),
-		&params
-	};
-	struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+	u64 start, delta;
 
-	status = wmi_evaluate_method(WMID_GUID3, 0, 0x2, &input, &output);
-	if (ACPI_FAILURE(status))
-		return status;
+	trace_acer_wmi_method_entry(guid, method_id, in);
 
-	obj = output.pointer;
-
-	if (!obj)
-		return AE_ERROR;
-	else if (obj->type != ACPI_TYPE_BUFFER) {
-		kfree(obj);
-		return AE_ERROR;
-	}
-	if (obj->buffer.length != 8) {
-		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
-		kfree(obj);
-		return AE_ERROR;
-	}
+	start = ktime_get_ns();
+	if (READ_ONCE(acer_replay.active))
+		status = acer_replay_call(ACER_REC_METHOD, guid, method_id, in, out);
+	else if (mock)
+		status = acer_mock_evaluate(guid, method_id, in, out);
+	else
+		status = wmi_evaluate_method(guid, instance, method_id, in, out);
+	delta = ktime_get_ns() - start;
 
-	return_value = *((struct wmid3_gds_return_value *)obj->buffer.pointer);
-	kfree(obj);
+	acer_rec_wmi(ACER_REC_METHOD, guid, method_id, in, status, out, start, delta);
 
-	if (return_value.error_code || return_value.ec_return_value)
-		pr_warn("Get 0x%x Device Status failed: 0x%x - 0x%x\n",
-			device,
-			return_value.error_code,
-			return_value.ec_return_value);
-	else
-		*value = !!(return_value.devices & device);
+	acer_lat_record(guid, method_id, delta);
+	trace_acer_wmi_method_exit(guid, method_id, status, out, delta);
 
 	return status;
 }
 
-static acpi_status wmid_v2_get_u32(u32 *value, u32 cap)
+static acpi_status acer_wmi_call_query(const char *guid, u8 instance,
+				       struct acpi_buffer *out)
 {
-	u16 device;
+	acpi_status status;
+	u64 start, delta;
 
-	switch (cap) {
-	case ACER_CAP_WIRELESS:
-		device = ACER_WMID3_GDS_WIRELESS;
-		break;
-	case ACER_CAP_BLUETOOTH:
-		device = ACER_WMID3_GDS_BLUETOOTH;
+	trace_acer_wmi_method_entry(guid, ACER_LAT_QUERY, NULL);
+
+	start = ktime_get_ns();
+	if (READ_ONCE(acer_replay.active))
+		status = acer_replay_call(ACER_REC_QUERY, guid, 0, NULL, out);
+	else if (mock)
+		status = acer_mock_query(guid, out);
+	else
+		status = wmi_query_block(guid, instance, out);
+	delta = ktime_get_ns() - start;
+
+	acer_rec_wmi(ACER_REC_QUERY, guid, 0, NULL, status, out, start, delta);
+
+	acer_lat_record(guid, ACER_LAT_QUERY, delta);
+	trace_acer_wmi_method_exit(guid, ACER_LAT_QUERY, status, out, delta);
+
+	return status;
+}
+
+/*
+ * WMI command scheduler
+ * WMI calls are run one at a time by a worker on a dedicated workqueue,
+ * highest priority class first and in submission order within a class,
+ * so a burst of lighting writes can't hold up a fan or turbo change.
+ * A command that waited longer than cmd_max_wait_ms is promoted ahead of
+ * higher classes, so a steady stream of those can't starve the rest.
+ * Callers either wait for their command or queue it and move on.
+ */
+enum acer_cmd_class {
+	ACER_CMD_THERMAL,	/* Fan behaviour, thermal profile and turbo */
+	ACER_CMD_HOTKEY,	/* Hotkey actions, rfkill and other device state */
+	ACER_CMD_SENSOR,	/* Sensor and status reads */
+	ACER_CMD_LIGHTING,	/* Keyboard backlight */
+	ACER_CMD_NR_CLASSES,
+};
+
+static const char * const acer_cmd_class_names[ACER_CMD_NR_CLASSES] = {
+	[ACER_CMD_THERMAL] = "thermal",
+	[ACER_CMD_HOTKEY] = "hotkey",
+	[ACER_CMD_SENSOR] = "sensor",
+	[ACER_CMD_LIGHTING] = "lighting",
+};
+
+struct acer_cmd {
+	struct list_head node;
+	enum acer_cmd_class class;
+	const char *guid;
+	u8 instance;
+	u32 method_id;		/* ACER_LAT_QUERY for block queries */
+	const struct acpi_buffer *in;
+	struct acpi_buffer *out;
+	acpi_status status;
+	u64 queue_ns;
+	bool async;		/* Freed by the scheduler once run */
+	struct completion done;
+	struct acpi_buffer in_copy;
+	u8 data[];
+};
+
+struct acer_cmd_stats {
+	u64 submitted;
+	u64 executed;
+	u64 inline_runs;	/* Run by the caller, outside the queue */
+	u64 promoted;		/* Run ahead of higher classes after waiting too long */
+	unsigned int depth;
+	unsigned int max_depth;
+	u64 wait_total_ns;
+	u64 wait_max_ns;
+};
+
+static struct acer_cmd_sched {
+	spinlock_t lock;
+	struct list_head queues[ACER_CMD_NR_CLASSES];
+	struct acer_cmd_stats stats[ACER_CMD_NR_CLASSES];
+	struct workqueue_struct *wq;
+	struct work_struct work;
+} acer_sched = {
+	.lock = __SPIN_LOCK_UNLOCKED(acer_sched.lock),
+};
+
+static enum acer_cmd_class acer_cmd_classify(const char *guid, u32 method_id)
+{
+	if (method_id == ACER_LAT_QUERY)
+		return ACER_CMD_SENSOR;
+
+	if (strcmp(guid, WMID_GUID4))
+		return ACER_CMD_HOTKEY;
+
+	switch (method_id) {
+	case ACER_WMID_SET_GAMING_LED_METHODID:
+	case ACER_WMID_SET_GAMING_FAN_BEHAVIOR:
+	case ACER_WMID_SET_GAMING_MISC_SETTING_METHODID:
+	case ACER_WMID_GET_GAMING_MISC_SETTING_METHODID:
+		return ACER_CMD_THERMAL;
+	case ACER_WMID_SET_GAMINGKBBL_METHODID:
+	case ACER_WMID_GET_GAMINGKBBL_METHODID:
+	case ACER_WMID_SET_GAMING_STATIC_LED_METHODID:
+		return ACER_CMD_LIGHTING;
+	default:
+		return ACER_CMD_SENSOR;
+	}
+}
+
+static void acer_cmd_run(struct acer_cmd *cmd)
+{
+	if (cmd->method_id == ACER_LAT_QUERY)
+		cmd->status = acer_wmi_call_query(cmd->guid, cmd->instance, cmd->out);
+	else
+		cmd->status = acer_wmi_call(cmd->guid, cmd->instance, cmd->method_id,
+					    cmd->in, cmd->out);
+}
+
+/*
+ * Must be called with the scheduler lock held. Returns the head of the
+ * highest class, or the head of the highest lower class that waited past
+ * cmd_max_wait_ms, and its class in *class.
+ */
+static struct acer_cmd *acer_cmd_next(u64 now, int *class, bool *promoted)
+{
+	u64 max_wait = (u64)READ_ONCE(cmd_max_wait_ms) * NSEC_PER_MSEC;
+	struct acer_cmd *cmd = NULL, *head;
+	int i;
+
+	*promoted = false;
+	for (i = 0; i < ACER_CMD_NR_CLASSES; i++) {
+		head = list_first_entry_or_null(&acer_sched.queues[i],
+						struct acer_cmd, node);
+		if (!head)
+			continue;
+
+		if (!cmd) {
+			cmd = head;
+			*class = i;
+			if (!max_wait)
+				break;
+		} else if (now - head->queue_ns > max_wait) {
+			cmd = head;
+			*class = i;
+			*promoted = true;
+			break;
+		}
+	}
+
+	return cmd;
+}
+
+static void acer_cmd_work(struct work_struct *work)
+{
+	struct acer_cmd_stats *stats;
+	struct acer_cmd *cmd;
+	bool promoted;
+	int class;
+	u64 now, wait;
+
+	for (;;) {
+		spin_lock(&acer_sched.lock);
+		/* Under the lock, so no queued command is newer */
+		now = ktime_get_ns();
+		cmd = acer_cmd_next(now, &class, &promoted);
+		if (!cmd) {
+			spin_unlock(&acer_sched.lock);
+			return;
+		}
+
+		list_del(&cmd->node);
+		wait = now - cmd->queue_ns;
+		stats = &acer_sched.stats[class];
+		stats->depth--;
+		stats->executed++;
+		if (promoted)
+			stats->promoted++;
+		stats->wait_total_ns += wait;
+		stats->wait_max_ns = max(stats->wait_max_ns, wait);
+		spin_unlock(&acer_sched.lock);
+
+		acer_cmd_run(cmd);
+
+		if (cmd->async)
+			kfree(cmd);
+		else
+			complete(&cmd->done);
+	}
+}
+
+static void acer_cmd_enqueue(struct acer_cmd *cmd)
+{
+	struct acer_cmd_stats *stats = &acer_sched.stats[cmd->class];
+
+	cmd->queue_ns = ktime_get_ns();
+
+	spin_lock(&acer_sched.lock);
+	list_add_tail(&cmd->node, &acer_sched.queues[cmd->class]);
+	stats->submitted++;
+	stats->depth++;
+	stats->max_depth = max(stats->max_depth, stats->depth);
+	spin_unlock(&acer_sched.lock);
+
+	queue_work(acer_sched.wq, &acer_sched.work);
+}
+
+/*
+ * Commands run inline before the scheduler is started and when submitted
+ * from its own worker, which would otherwise wait on itself.
+ */
+static bool acer_cmd_run_inline(struct acer_cmd *cmd)
+{
+	if (acer_sched.wq && current_work() != &acer_sched.work)
+		return false;
+
+	spin_lock(&acer_sched.lock);
+	acer_sched.stats[cmd->class].inline_runs++;
+	spin_unlock(&acer_sched.lock);
+
+	acer_cmd_run(cmd);
+	return true;
+}
+
+/* Run a command and wait for it */
+static acpi_status acer_cmd_execute(enum acer_cmd_class class, const char *guid,
+				    u8 instance, u32 method_id,
+				    const struct acpi_buffer *in, struct acpi_buffer *out)
+{
+	struct acer_cmd cmd = {
+		.class = class,
+		.guid = guid,
+		.instance = instance,
+		.method_id = method_id,
+		.in = in,
+		.out = out,
+	};
+
+	if (acer_cmd_run_inline(&cmd))
+		return cmd.status;
+
+	init_completion(&cmd.done);
+	acer_cmd_enqueue(&cmd);
+	wait_for_completion(&cmd.done);
+
+	return cmd.status;
+}
+
+/* Queue a command without waiting, the result is discarded */
+static int acer_cmd_queue(enum acer_cmd_class class, const char *guid, u32 method_id,
+			  const void *in, size_t len)
+{
+	struct acer_cmd *cmd;
+
+	cmd = kzalloc(struct_size(cmd, data, len), GFP_KERNEL);
+	if (!cmd)
+		return -ENOMEM;
+
+	memcpy(cmd->data, in, len);
+	cmd->in_copy = (struct acpi_buffer) { len, cmd->data };
+	cmd->class = class;
+	cmd->guid = guid;
+	cmd->method_id = method_id;
+	cmd->in = &cmd->in_copy;
+	cmd->async = true;
+
+	if (acer_cmd_run_inline(cmd)) {
+		kfree(cmd);
+		return 0;
+	}
+
+	acer_cmd_enqueue(cmd);
+	return 0;
+}
+
+static acpi_status acer_wmi_evaluate_method(const char *guid, u8 instance, u32 method_id,
+					    const struct acpi_buffer *in,
+					    struct acpi_buffer *out)
+{
+	return acer_cmd_execute(acer_cmd_classify(guid, method_id), guid, instance,
+				method_id, in, out);
+}
+
+static acpi_status acer_wmi_query_block(const char *guid, u8 instance,
+					struct acpi_buffer *out)
+{
+	return acer_cmd_execute(ACER_CMD_SENSOR, guid, instance, ACER_LAT_QUERY,
+				NULL, out);
+}
+
+static int __init acer_cmd_init(void)
+{
+	int class;
+
+	for (class = 0; class < ACER_CMD_NR_CLASSES; class++)
+		INIT_LIST_HEAD(&acer_sched.queues[class]);
+	INIT_WORK(&acer_sched.work, acer_cmd_work);
+
+	acer_sched.wq = alloc_ordered_workqueue("acer-wmi", WQ_HIGHPRI);
+	if (!acer_sched.wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void acer_cmd_exit(void)
+{
+	/* Runs the commands still queued */
+	destroy_workqueue(acer_sched.wq);
+	acer_sched.wq = NULL;
+}
+
+static int acer_ec_read(u8 addr, u8 *val)
+{
+	u64 start = ktime_get_ns();
+	u64 delta;
+	int err;
+
+	if (READ_ONCE(acer_replay.active))
+		err = acer_replay_ec(ACER_REC_EC_READ, addr, val);
+	else
+		err = mock ? acer_mock_ec_read(addr, val) : ec_read(addr, val);
+	delta = ktime_get_ns() - start;
+
+	acer_rec_ec(ACER_REC_EC_READ, addr, err ? 0 : *val, err, start, delta);
+
+	acer_lat_record(ACER_LAT_EC_READ, addr, delta);
+	trace_acer_ec_access(false, addr, err ? 0 : *val, err, delta);
+
+	return err;
+}
+
+static int acer_ec_write(u8 addr, u8 val)
+{
+	u64 start = ktime_get_ns();
+	u64 delta;
+	int err;
+
+	if (READ_ONCE(acer_replay.active))
+		err = acer_replay_ec(ACER_REC_EC_WRITE, addr, &val);
+	else
+		err = mock ? acer_mock_ec_write(addr, val) : ec_write(addr, val);
+	delta = ktime_get_ns() - start;
+
+	acer_rec_ec(ACER_REC_EC_WRITE, addr, val, err, start, delta);
+
+	acer_lat_record(ACER_LAT_EC_WRITE, addr, delta);
+	trace_acer_ec_access(true, addr, val, err, delta);
+
+	return err;
+}
+
+/*
+ * AMW0 (V1) interface
+ */
+struct wmab_args {
+	u32 eax;
+	u32 ebx;
+	u32 ecx;
+	u32 edx;
+};
+
+struct wmab_ret {
+	u32 eax;
+	u32 ebx;
+	u32 ecx;
+	u32 edx;
+	u32 eex;
+};
+
+static acpi_status wmab_execute(struct wmab_args *regbuf,
+struct acpi_buffer *result)
+{
+	struct acpi_buffer input;
+	acpi_status status;
+	input.length = sizeof(struct wmab_args);
+	input.pointer = (u8 *)regbuf;
+
+	status = acer_wmi_evaluate_method(AMW0_GUID1, 0, 1, &input, result);
+
+	return status;
+}
+
+static acpi_status AMW0_get_u32(u32 *value, u32 cap)
+{
+	int err;
+	u8 result;
+
+	switch (cap) {
+	case ACER_CAP_MAILLED:
+		switch (quirks->mailled) {
+		default:
+			err = acer_ec_read(0xA, &result);
+			if (err)
+				return AE_ERROR;
+			*value = (result >> 7) & 0x1;
+			return AE_OK;
+		}
 		break;
-	case ACER_CAP_THREEG:
-		device = ACER_WMID3_GDS_THREEG;
+	case ACER_CAP_WIRELESS:
+		switch (quirks->wireless) {
+		case 1:
+			err = acer_ec_read(0x7B, &result);
+			if (err)
+				return AE_ERROR;
+			*value = result & 0x1;
+			return AE_OK;
+		case 2:
+			err = acer_ec_read(0x71, &result);
+			if (err)
+				return AE_ERROR;
+			*value = result & 0x1;
+			return AE_OK;
+		case 3:
+			err = acer_ec_read(0x78, &result);
+			if (err)
+				return AE_ERROR;
+			*value = result & 0x1;
+			return AE_OK;
+		default:
+			err = acer_ec_read(0xA, &result);
+			if (err)
+				return AE_ERROR;
+			*value = (result >> 2) & 0x1;
+			return AE_OK;
+		}
+		break;
+	case ACER_CAP_BLUETOOTH:
+		switch (quirks->bluetooth) {
+		default:
+			err = acer_ec_read(0xA, &result);
+			if (err)
+				return AE_ERROR;
+			*value = (result >> 4) & 0x1;
+			return AE_OK;
+		}
+		break;
+	case ACER_CAP_BRIGHTNESS:
+		switch (quirks->brightness) {
+		default:
+			err = acer_ec_read(0x83, &result);
+			if (err)
+				return AE_ERROR;
+			*value = result;
+			return AE_OK;
+		}
+		break;
+	default:
+		return AE_ERROR;
+	}
+	return AE_OK;
+}
+
+static acpi_status AMW0_set_u32(u32 value, u32 cap)
+{
+	struct wmab_args args;
+
+	args.eax = ACER_AMW0_WRITE;
+	args.ebx = value ? (1<<8) : 0;
+	args.ecx = args.edx = 0;
+
+	switch (cap) {
+	case ACER_CAP_MAILLED:
+		if (value > 1)
+			return AE_BAD_PARAMETER;
+		args.ebx |= ACER_AMW0_MAILLED_MASK;
+		break;
+	case ACER_CAP_WIRELESS:
+		if (value > 1)
+			return AE_BAD_PARAMETER;
+		args.ebx |= ACER_AMW0_WIRELESS_MASK;
+		break;
+	case ACER_CAP_BLUETOOTH:
+		if (value > 1)
+			return AE_BAD_PARAMETER;
+		args.ebx |= ACER_AMW0_BLUETOOTH_MASK;
 		break;
+	case ACER_CAP_BRIGHTNESS:
+		if (value > max_brightness)
+			return AE_BAD_PARAMETER;
+		switch (quirks->brightness) {
+		default:
+			return acer_ec_write(0x83, value);
+		}
 	default:
 		return AE_ERROR;
 	}
-	return wmid3_get_device_status(value, device);
+
+	/* Actually do the set */
+	return wmab_execute(&args, NULL);
+}
+
+static acpi_status __init AMW0_find_mailled(void)
+{
+	struct wmab_args args;
+	struct wmab_ret ret;
+	acpi_status status = AE_OK;
+	struct acpi_buffer out = { ACPI_ALLOCATE_BUFFER, NULL };
+	union acpi_object *obj;
+
+	args.eax = 0x86;
+	args.ebx = args.ecx = args.edx = 0;
+
+	status = wmab_execute(&args, &out);
+	if (ACPI_FAILURE(status))
+		return status;
+
+	obj = (union acpi_object *) out.pointer;
+	if (obj && obj->type == ACPI_TYPE_BUFFER &&
+	obj->buffer.length == sizeof(struct wmab_ret)) {
+		ret = *((struct wmab_ret *) obj->buffer.pointer);
+	} else {
+		kfree(out.pointer);
+		return AE_ERROR;
+	}
+
+	if (ret.eex & 0x1)
+		interface->capability |= ACER_CAP_MAILLED;
+
+	kfree(out.pointer);
+
+	return AE_OK;
+}
+
+static const struct acpi_device_id norfkill_ids[] __initconst = {
+	{ "VPC2004", 0},
+	{ "IBM0068", 0},
+	{ "LEN0068", 0},
+	{ "SNY5001", 0},	/* sony-laptop in charge */
+	{ "HPQ6601", 0},
+	{ "", 0},
+};
+
+static int __init AMW0_set_cap_acpi_check_device(void)
+{
+	const struct acpi_device_id *id;
+
+	for (id = norfkill_ids; id->id[0]; id++)
+		if (acpi_dev_found(id->id))
+			return true;
+
+	return false;
+}
+
+static acpi_status __init AMW0_set_capabilities(void)
+{
+	struct wmab_args args;
+	struct wmab_ret ret;
+	acpi_status status;
+	struct acpi_buffer out = { ACPI_ALLOCATE_BUFFER, NULL };
+	union acpi_object *obj;
+
+	/*
+	 * On laptops with this strange GUID (non Acer), normal probing doesn't
+	 * work.
+	 */
+	if (has_guid(ACER_GUID_AMW0_2)) {
+		if ((quirks != &quirk_unknown) ||
+		    !AMW0_set_cap_acpi_check_device())
+			interface->capability |= ACER_CAP_WIRELESS;
+		return AE_OK;
+	}
+
+	args.eax = ACER_AMW0_WRITE;
+	args.ecx = args.edx = 0;
+
+	args.ebx = 0xa2 << 8;
+	args.ebx |= ACER_AMW0_WIRELESS_MASK;
+
+	status = wmab_execute(&args, &out);
+	if (ACPI_FAILURE(status))
+		return status;
+
+	obj = out.pointer;
+	if (obj && obj->type == ACPI_TYPE_BUFFER &&
+	obj->buffer.length == sizeof(struct wmab_ret)) {
+		ret = *((struct wmab_ret *) obj->buffer.pointer);
+	} else {
+		status = AE_ERROR;
+		goto out;
+	}
+
+	if (ret.eax & 0x1)
+		interface->capability |= ACER_CAP_WIRELESS;
+
+	args.ebx = 2 << 8;
+	args.ebx |= ACER_AMW0_BLUETOOTH_MASK;
+
+	/*
+	 * It's ok to use existing buffer for next wmab_execute call.
+	 * But we need to kfree(out.pointer) if next wmab_execute fail.
+	 */
+	status = wmab_execute(&args, &out);
+	if (ACPI_FAILURE(status))
+		goto out;
+
+	obj = (union acpi_object *) out.pointer;
+	if (obj && obj->type == ACPI_TYPE_BUFFER
+	&& obj->buffer.length == sizeof(struct wmab_ret)) {
+		ret = *((struct wmab_ret *) obj->buffer.pointer);
+	} else {
+		status = AE_ERROR;
+		goto out;
+	}
+
+	if (ret.eax & 0x1)
+		interface->capability |= ACER_CAP_BLUETOOTH;
+
+	/*
+	 * This appears to be safe to enable, since all Wistron based laptops
+	 * appear to use the same EC register for brightness, even if they
+	 * differ for wireless, etc
+	 */
+	if (quirks->brightness >= 0)
+		interface->capability |= ACER_CAP_BRIGHTNESS;
+
+	status = AE_OK;
+out:
+	kfree(out.pointer);
+	return status;
+}
+
+static struct wmi_interface AMW0_interface = {
+	.type = ACER_AMW0,
+};
+
+static struct wmi_interface AMW0_V2_interface = {
+	.type = ACER_AMW0_V2,
+};
+
+/*
+ * WMI method execution
+ * Methods with a known result size are evaluated into a buffer on the
+ * caller's stack. ACPICA only notices a result doesn't fit after running
+ * the method, and a method is never run twice since most of them change
+ * the firmware state, so such a result fails the call. These overflows
+ * are counted in debugfs and should stay at zero. Setters, block queries
+ * and methods with an unknown result size get an allocated buffer.
+ */
+#define ACER_WMI_RESULT_INLINE_LEN 64
+
+/* Result length of a method whose result is unknown or unused */
+#define ACER_WMI_RESULT_ALLOC 0
+
+struct acer_wmi_result {
+	union acpi_object *obj;		/* NULL if the method returned nothing */
+	void *alloc;
+	union {
+		union acpi_object obj;
+		u8 raw[sizeof(union acpi_object) + ACER_WMI_RESULT_INLINE_LEN];
+	} buf;
+};
+
+static atomic_t acer_wmi_result_overflows = ATOMIC_INIT(0);
+
+static void acer_wmi_result_init(struct acer_wmi_result *res, struct acpi_buffer *out,
+				 size_t out_len)
+{
+	res->obj = NULL;
+	res->alloc = NULL;
+	if (out_len == ACER_WMI_RESULT_ALLOC || out_len > ACER_WMI_RESULT_INLINE_LEN) {
+		*out = (struct acpi_buffer) { ACPI_ALLOCATE_BUFFER, NULL };
+	} else {
+		out->length = sizeof(res->buf);
+		out->pointer = &res->buf;
+	}
+}
+
+static void acer_wmi_result_done(struct acer_wmi_result *res, acpi_status status,
+				 struct acpi_buffer *out)
+{
+	if (status == AE_BUFFER_OVERFLOW)
+		atomic_inc(&acer_wmi_result_overflows);
+	if (out->pointer != &res->buf)
+		res->alloc = out->pointer;
+	if (ACPI_SUCCESS(status) && out->length)
+		res->obj = out->pointer;
+}
+
+/*
+ * Evaluate a method whose result is out_len bytes long, or
+ * ACER_WMI_RESULT_ALLOC. res must be released with acer_wmi_result_free().
+ */
+static acpi_status acer_wmi_evaluate(const char *guid, u32 method_id,
+				     const struct acpi_buffer *input, size_t out_len,
+				     struct acer_wmi_result *res)
+{
+	struct acpi_buffer out;
+	acpi_status status;
+
+	acer_wmi_result_init(res, &out, out_len);
+	status = acer_wmi_evaluate_method(guid, 0, method_id, input, &out);
+	acer_wmi_result_done(res, status, &out);
+
+	return status;
+}
+
+/* Same as acer_wmi_evaluate() for data blocks, which have no known size */
+static acpi_status acer_wmi_query(const char *guid, struct acer_wmi_result *res)
+{
+	struct acpi_buffer out;
+	acpi_status status;
+
+	acer_wmi_result_init(res, &out, ACER_WMI_RESULT_ALLOC);
+	status = acer_wmi_query_block(guid, 0, &out);
+	acer_wmi_result_done(res, status, &out);
+
+	return status;
+}
+
+static void acer_wmi_result_free(struct acer_wmi_result *res)
+{
+	kfree(res->alloc);
+}
+
+/*
+ * WMID method table
+ * Every WMID method the driver evaluates is declared once here, with its
+ * GUID, method ID and the length of its input and of its result. Integer
+ * results are decoded the same way for all methods: an ACPI integer, or a
+ * little endian buffer of at least 4 bytes.
+ */
+#define ACER_WMI_LEN_NONE	0
+#define ACER_WMI_LEN_U32	sizeof(u32)
+#define ACER_WMI_LEN_U64	sizeof(u64)
+#define ACER_WMI_LEN_KBBL	GAMING_KBBL_CONFIG_LEN
+#define ACER_WMI_LEN_ZONE	GAMING_KBBL_STATIC_CONFIG_LEN
+
+/* M(name, guid, method id, input, result) */
+#define ACER_WMI_METHODS(M)							\
+	M(GET_WIRELESS,		WMID_GUID1, ACER_WMID_GET_WIRELESS_METHODID,	U32,  U32)	\
+	M(GET_BLUETOOTH,	WMID_GUID1, ACER_WMID_GET_BLUETOOTH_METHODID,	U32,  U32)	\
+	M(GET_BRIGHTNESS,	WMID_GUID1, ACER_WMID_GET_BRIGHTNESS_METHODID,	U32,  U32)	\
+	M(GET_THREEG,		WMID_GUID1, ACER_WMID_GET_THREEG_METHODID,	U32,  U32)	\
+	M(SET_WIRELESS,		WMID_GUID1, ACER_WMID_SET_WIRELESS_METHODID,	U32,  NONE)	\
+	M(SET_BLUETOOTH,	WMID_GUID1, ACER_WMID_SET_BLUETOOTH_METHODID,	U32,  NONE)	\
+	M(SET_BRIGHTNESS,	WMID_GUID1, ACER_WMID_SET_BRIGHTNESS_METHODID,	U32,  NONE)	\
+	M(SET_THREEG,		WMID_GUID1, ACER_WMID_SET_THREEG_METHODID,	U32,  NONE)	\
+	/* No mail LED method is known, kept as it always was */		\
+	M(SET_MAILLED,		WMID_GUID1, 0,					U32,  NONE)	\
+	M(SET_GAMINGKBBL,	WMID_GUID4, ACER_WMID_SET_GAMINGKBBL_METHODID,	KBBL, NONE)	\
+	M(GET_GAMINGKBBL,	WMID_GUID4, ACER_WMID_GET_GAMINGKBBL_METHODID,	U32,  KBBL)	\
+	M(SET_GAMING_LED,	WMID_GUID4, ACER_WMID_SET_GAMING_LED_METHODID,	U64,  NONE)	\
+	M(GET_GAMING_LED,	WMID_GUID4, ACER_WMID_GET_GAMING_LED_METHODID,	U64,  U64)	\
+	M(GET_GAMING_SYS_INFO,	WMID_GUID4, ACER_WMID_GET_GAMING_SYS_INFO_METHODID, U64, U64)	\
+	M(SET_GAMING_STATIC_LED, WMID_GUID4, ACER_WMID_SET_GAMING_STATIC_LED_METHODID, ZONE, NONE) \
+	M(SET_GAMING_FAN,	WMID_GUID4, ACER_WMID_SET_GAMING_FAN_BEHAVIOR,	U64,  NONE)	\
+	M(SET_GAMING_MISC,	WMID_GUID4, ACER_WMID_SET_GAMING_MISC_SETTING_METHODID, U64, U64) \
+	M(GET_GAMING_MISC,	WMID_GUID4, ACER_WMID_GET_GAMING_MISC_SETTING_METHODID, U32, U64)
+
+/* ACER_WMI_NONE marks "no method" in tables indexed by capability */
+enum acer_wmi_method {
+	ACER_WMI_NONE,
+#define ACER_WMI_METHOD_ENUM(name, guid, id, in, out) ACER_WMI_##name,
+	ACER_WMI_METHODS(ACER_WMI_METHOD_ENUM)
+#undef ACER_WMI_METHOD_ENUM
+	ACER_WMI_METHOD_COUNT,
+};
+
+/* Input length of each method as a constant expression */
+enum {
+#define ACER_WMI_METHOD_IN_LEN(name, guid, id, in, out)	\
+	ACER_WMI_##name##_IN_LEN = ACER_WMI_LEN_##in,
+	ACER_WMI_METHODS(ACER_WMI_METHOD_IN_LEN)
+#undef ACER_WMI_METHOD_IN_LEN
+};
+
+struct acer_wmi_method_desc {
+	const char *name;
+	const char *guid;
+	u32 method_id;
+	u8 in_len;
+	u8 out_len;
+};
+
+static const struct acer_wmi_method_desc acer_wmi_methods[ACER_WMI_METHOD_COUNT] = {
+#define ACER_WMI_METHOD_DESC(_name, _guid, _id, _in, _out)	\
+	[ACER_WMI_##_name] = {					\
+		.name = #_name,					\
+		.guid = _guid,					\
+		.method_id = _id,				\
+		.in_len = ACER_WMI_LEN_##_in,			\
+		.out_len = ACER_WMI_LEN_##_out,			\
+	},
+	ACER_WMI_METHODS(ACER_WMI_METHOD_DESC)
+#undef ACER_WMI_METHOD_DESC
+};
+
+/* Checks on the table and on the bit fields packed into method inputs */
+static void __init acer_wmi_methods_check(void)
+{
+#define ACER_WMI_METHOD_CHECK(name, guid, id, in, out)			\
+	BUILD_BUG_ON(ACER_WMI_LEN_##in > U8_MAX);			\
+	BUILD_BUG_ON(ACER_WMI_LEN_##out > ACER_WMI_RESULT_INLINE_LEN);
+	ACER_WMI_METHODS(ACER_WMI_METHOD_CHECK)
+#undef ACER_WMI_METHOD_CHECK
+
+	BUILD_BUG_ON(ACER_GAMING_MISC_SETTING_INDEX_MASK &
+		     ACER_GAMING_MISC_SETTING_VALUE_MASK);
+	/* The index of a misc setting read is passed as a u32 */
+	BUILD_BUG_ON(ACER_GAMING_MISC_SETTING_INDEX_MASK > U32_MAX);
+	BUILD_BUG_ON(ACER_PREDATOR_V4_RETURN_STATUS_BIT_MASK &
+		     ACER_PREDATOR_V4_SENSOR_READING_BIT_MASK);
+	BUILD_BUG_ON(ACER_PREDATOR_V4_RETURN_STATUS_BIT_MASK &
+		     ACER_PREDATOR_V4_FAN_SPEED_READ_BIT_MASK);
+	BUILD_BUG_ON(ACER_PREDATOR_V4_SENSOR_READING_BIT_MASK &
+		     ACER_PREDATOR_V4_SUPPORTED_SENSORS_BIT_MASK);
+	/* Trace format, documented in the README */
+	BUILD_BUG_ON(sizeof(struct acer_rec) != 44);
+	/* ACER_SENSOR() places the sensor ID with a plain shift */
+	BUILD_BUG_ON(ACER_PREDATOR_V4_SENSOR_INDEX_BIT_MASK != GENMASK_ULL(15, 8));
+}
+
+static int acer_wmi_decode_u64(const union acpi_object *obj, u64 *out)
+{
+	switch (obj->type) {
+	case ACPI_TYPE_INTEGER:
+		*out = obj->integer.value;
+		return 0;
+	case ACPI_TYPE_BUFFER:
+		if (obj->buffer.length >= sizeof(u64))
+			*out = get_unaligned_le64(obj->buffer.pointer);
+		else if (obj->buffer.length >= sizeof(u32))
+			*out = get_unaligned_le32(obj->buffer.pointer);
+		else
+			return -ENOMSG;
+		return 0;
+	default:
+		return -ENOMSG;
+	}
+}
+
+/*
+ * Evaluate a table method. in_len must match the table. With out_int set,
+ * the integer result is stored there, a missing result reads as 0. With
+ * out_buf set, the result must be a buffer of at least the table length.
+ */
+static __always_inline acpi_status
+acer_wmi_exec(enum acer_wmi_method method, const void *in, size_t in_len,
+	      u64 *out_int, void *out_buf)
+{
+	const struct acer_wmi_method_desc *desc = &acer_wmi_methods[method];
+	struct acpi_buffer input = { (acpi_size) in_len, (void *)in };
+	struct acer_wmi_result result;
+	const union acpi_object *obj;
+	acpi_status status;
+	u64 tmp = 0;
+
+	if (WARN_ON_ONCE(method == ACER_WMI_NONE || in_len != desc->in_len))
+		return AE_BAD_PARAMETER;
+
+	status = acer_wmi_evaluate(desc->guid, desc->method_id, &input,
+				   desc->out_len, &result);
+	if (ACPI_FAILURE(status))
+		goto out_free;
+
+	obj = result.obj;
+	if (out_buf) {
+		if (!obj || obj->type != ACPI_TYPE_BUFFER ||
+		    obj->buffer.length < desc->out_len) {
+			status = AE_ERROR;
+			goto out_free;
+		}
+		memcpy(out_buf, obj->buffer.pointer, desc->out_len);
+	}
+
+	if (out_int) {
+		if (obj && acer_wmi_decode_u64(obj, &tmp)) {
+			status = AE_ERROR;
+			goto out_free;
+		}
+		*out_int = tmp;
+	}
+
+out_free:
+	acer_wmi_result_free(&result);
+
+	return status;
+}
+
+/* Executors for the u32 and u64 input layouts, checked against the table */
+static __always_inline acpi_status
+acer_wmi_exec_u32(enum acer_wmi_method method, u32 in, u64 *out)
+{
+	return acer_wmi_exec(method, &in, sizeof(in), out, NULL);
+}
+
+static __always_inline acpi_status
+acer_wmi_exec_u64(enum acer_wmi_method method, u64 in, u64 *out)
+{
+	return acer_wmi_exec(method, &in, sizeof(in), out, NULL);
+}
+
+#define acer_wmi_call_u32(name, in, out) ({				\
+	BUILD_BUG_ON(ACER_WMI_##name##_IN_LEN != ACER_WMI_LEN_U32);	\
+	acer_wmi_exec_u32(ACER_WMI_##name, in, out);			\
+})
+
+#define acer_wmi_call_u64(name, in, out) ({				\
+	BUILD_BUG_ON(ACER_WMI_##name##_IN_LEN != ACER_WMI_LEN_U64);	\
+	acer_wmi_exec_u64(ACER_WMI_##name, in, out);			\
+})
+
+/*
+ * New interface (The WMID interface)
+ */
+
+static acpi_status WMID_get_u32(u32 *value, u32 cap)
+{
+	enum acer_wmi_method method;
+	acpi_status status;
+	u64 result;
+	u8 tmp;
+
+	switch (cap) {
+	case ACER_CAP_WIRELESS:
+		method = ACER_WMI_GET_WIRELESS;
+		break;
+	case ACER_CAP_BLUETOOTH:
+		method = ACER_WMI_GET_BLUETOOTH;
+		break;
+	case ACER_CAP_BRIGHTNESS:
+		method = ACER_WMI_GET_BRIGHTNESS;
+		break;
+	case ACER_CAP_THREEG:
+		method = ACER_WMI_GET_THREEG;
+		break;
+	case ACER_CAP_MAILLED:
+		if (quirks->mailled == 1) {
+			acer_ec_read(0x9f, &tmp);
+			*value = tmp & 0x1;
+			return 0;
+		}
+		fallthrough;
+	default:
+		return AE_ERROR;
+	}
+	status = acer_wmi_exec_u32(method, 0, &result);
+
+	if (ACPI_SUCCESS(status))
+		*value = (u8)result;
+
+	return status;
+}
+
+static acpi_status WMID_set_u32(u32 value, u32 cap)
+{
+	enum acer_wmi_method method;
+	char param;
+
+	switch (cap) {
+	case ACER_CAP_BRIGHTNESS:
+		if (value > max_brightness)
+			return AE_BAD_PARAMETER;
+		method = ACER_WMI_SET_BRIGHTNESS;
+		break;
+	case ACER_CAP_WIRELESS:
+		if (value > 1)
+			return AE_BAD_PARAMETER;
+		method = ACER_WMI_SET_WIRELESS;
+		break;
+	case ACER_CAP_BLUETOOTH:
+		if (value > 1)
+			return AE_BAD_PARAMETER;
+		method = ACER_WMI_SET_BLUETOOTH;
+		break;
+	case ACER_CAP_THREEG:
+		if (value > 1)
+			return AE_BAD_PARAMETER;
+		method = ACER_WMI_SET_THREEG;
+		break;
+	case ACER_CAP_MAILLED:
+		if (value > 1)
+			return AE_BAD_PARAMETER;
+		if (quirks->mailled == 1) {
+			param = value ? 0x92 : 0x93;
+			i8042_lock_chip();
+			i8042_command(&param, 0x1059);
+			i8042_unlock_chip();
+			return 0;
+		}
+		method = ACER_WMI_SET_MAILLED;
+		break;
+	default:
+		return AE_ERROR;
+	}
+	return acer_wmi_exec_u32(method, value, NULL);
+}
+
+static acpi_status wmid3_get_device_status(u32 *value, u16 device)
+{
+	struct wmid3_gds_return_value return_value;
+	acpi_status status;
+	union acpi_object *obj;
+	struct wmid3_gds_get_input_param params = {
+		.function_num = 0x1,
+		.hotkey_number = commun_fn_key_number,
+		.devices = device,
+	};
+	struct acpi_buffer input = {
+		sizeof(struct wmid3_gds_get_input_param),
+		&params
+	};
+	struct acer_wmi_result output;
+
+	status = acer_wmi_evaluate(WMID_GUID3, 0x2, &input,
+				   sizeof(struct wmid3_gds_return_value), &output);
+	if (ACPI_FAILURE(status))
+		goto out_free;
+
+	obj = output.obj;
+
+	if (!obj || obj->type != ACPI_TYPE_BUFFER) {
+		status = AE_ERROR;
+		goto out_free;
+	}
+	if (obj->buffer.length != 8) {
+		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
+		status = AE_ERROR;
+		goto out_free;
+	}
+
+	return_value = *((struct wmid3_gds_return_value *)obj->buffer.pointer);
+	acer_wmi_result_free(&output);
+
+	if (return_value.error_code || return_value.ec_return_value)
+		pr_warn("Get 0x%x Device Status failed: 0x%x - 0x%x\n",
+			device,
+			return_value.error_code,
+			return_value.ec_return_value);
+	else
+		*value = !!(return_value.devices & device);
+
+	return status;
+
+out_free:
+	acer_wmi_result_free(&output);
+	return status;
+}
+
+static acpi_status wmid_v2_get_u32(u32 *value, u32 cap)
+{
+	u16 device;
+
+	switch (cap) {
+	case ACER_CAP_WIRELESS:
+		device = ACER_WMID3_GDS_WIRELESS;
+		break;
+	case ACER_CAP_BLUETOOTH:
+		device = ACER_WMID3_GDS_BLUETOOTH;
+		break;
+	case ACER_CAP_THREEG:
+		device = ACER_WMID3_GDS_THREEG;
+		break;
+	default:
+		return AE_ERROR;
+	}
+	return wmid3_get_device_status(value, device);
+}
+
+static acpi_status wmid3_set_device_status(u32 value, u16 device)
+{
+	struct wmid3_gds_return_value return_value;
+	acpi_status status;
+	union acpi_object *obj;
+	u16 devices;
+	struct wmid3_gds_get_input_param get_params = {
+		.function_num = 0x1,
+		.hotkey_number = commun_fn_key_number,
+		.devices = commun_func_bitmap,
+	};
+	struct acpi_buffer get_input = {
+		sizeof(struct wmid3_gds_get_input_param),
+		&get_params
+	};
+	struct wmid3_gds_set_input_param set_params = {
+		.function_num = 0x2,
+		.hotkey_number = commun_fn_key_number,
+		.devices = commun_func_bitmap,
+	};
+	struct acpi_buffer set_input = {
+		sizeof(struct wmid3_gds_set_input_param),
+		&set_params
+	};
+	struct acer_wmi_result output;
+
+	status = acer_wmi_evaluate(WMID_GUID3, 0x2, &get_input,
+				   sizeof(struct wmid3_gds_return_value), &output);
+	if (ACPI_FAILURE(status))
+		goto out_free;
+
+	obj = output.obj;
+
+	if (!obj || obj->type != ACPI_TYPE_BUFFER) {
+		status = AE_ERROR;
+		goto out_free;
+	}
+	if (obj->buffer.length != 8) {
+		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
+		status = AE_ERROR;
+		goto out_free;
+	}
+
+	return_value = *((struct wmid3_gds_return_value *)obj->buffer.pointer);
+	acer_wmi_result_free(&output);
+
+	if (return_value.error_code || return_value.ec_return_value) {
+		pr_warn("Get Current Device Status failed: 0x%x - 0x%x\n",
+			return_value.error_code,
+			return_value.ec_return_value);
+		return status;
+	}
+
+	devices = return_value.devices;
+	set_params.devices = (value) ? (devices | device) : (devices & ~device);
+
+	status = acer_wmi_evaluate(WMID_GUID3, 0x1, &set_input,
+				   ACER_WMI_RESULT_ALLOC, &output);
+	if (ACPI_FAILURE(status))
+		goto out_free;
+
+	obj = output.obj;
+
+	if (!obj || obj->type != ACPI_TYPE_BUFFER) {
+		status = AE_ERROR;
+		goto out_free;
+	}
+	if (obj->buffer.length != 4) {
+		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
+		status = AE_ERROR;
+		goto out_free;
+	}
+
+	return_value = *((struct wmid3_gds_return_value *)obj->buffer.pointer);
+
+	if (return_value.error_code || return_value.ec_return_value)
+		pr_warn("Set Device Status failed: 0x%x - 0x%x\n",
+			return_value.error_code,
+			return_value.ec_return_value);
+
+out_free:
+	acer_wmi_result_free(&output);
+	return status;
+}
+
+static acpi_status wmid_v2_set_u32(u32 value, u32 cap)
+{
+	u16 device;
+
+	switch (cap) {
+	case ACER_CAP_WIRELESS:
+		device = ACER_WMID3_GDS_WIRELESS;
+		break;
+	case ACER_CAP_BLUETOOTH:
+		device = ACER_WMID3_GDS_BLUETOOTH;
+		break;
+	case ACER_CAP_THREEG:
+		device = ACER_WMID3_GDS_THREEG;
+		break;
+	default:
+		return AE_ERROR;
+	}
+	return wmid3_set_device_status(value, device);
+}
+
+static void __init type_aa_dmi_decode(const struct dmi_header *header, void *d)
+{
+	struct hotkey_function_type_aa *type_aa;
+
+	/* We are looking for OEM-specific Type AAh */
+	if (header->type != 0xAA)
+		return;
+
+	has_type_aa = true;
+	type_aa = (struct hotkey_function_type_aa *) header;
+
+	pr_info("Function bitmap for Communication Button: 0x%x\n",
+		type_aa->commun_func_bitmap);
+	commun_func_bitmap = type_aa->commun_func_bitmap;
+
+	if (type_aa->commun_func_bitmap & ACER_WMID3_GDS_WIRELESS)
+		interface->capability |= ACER_CAP_WIRELESS;
+	if (type_aa->commun_func_bitmap & ACER_WMID3_GDS_THREEG)
+		interface->capability |= ACER_CAP_THREEG;
+	if (type_aa->commun_func_bitmap & ACER_WMID3_GDS_BLUETOOTH)
+		interface->capability |= ACER_CAP_BLUETOOTH;
+	if (type_aa->commun_func_bitmap & ACER_WMID3_GDS_RFBTN)
+		commun_func_bitmap &= ~ACER_WMID3_GDS_RFBTN;
+
+	commun_fn_key_number = type_aa->commun_fn_key_number;
+}
+
+static acpi_status __init WMID_set_capabilities(void)
+{
+	struct acer_wmi_result out;
+	union acpi_object *obj;
+	acpi_status status;
+	u32 devices;
+
+	status = acer_wmi_query(WMID_GUID2, &out);
+	if (ACPI_FAILURE(status))
+		goto out_free;
+
+	obj = out.obj;
+	if (obj) {
+		if (obj->type == ACPI_TYPE_BUFFER &&
+			(obj->buffer.length == sizeof(u32) ||
+			obj->buffer.length == sizeof(u64))) {
+			devices = *((u32 *) obj->buffer.pointer);
+		} else if (obj->type == ACPI_TYPE_INTEGER) {
+			devices = (u32) obj->integer.value;
+		} else {
+			status = AE_ERROR;
+			goto out_free;
+		}
+	} else {
+		status = AE_ERROR;
+		goto out_free;
+	}
+
+	pr_info("Function bitmap for Communication Device: 0x%x\n", devices);
+	if (devices & 0x07)
+		interface->capability |= ACER_CAP_WIRELESS;
+	if (devices & 0x40)
+		interface->capability |= ACER_CAP_THREEG;
+	if (devices & 0x10)
+		interface->capability |= ACER_CAP_BLUETOOTH;
+
+	if (!(devices & 0x20))
+		max_brightness = 0x9;
+
+out_free:
+	acer_wmi_result_free(&out);
+	return status;
+}
+
+static struct wmi_interface wmid_interface = {
+	.type = ACER_WMID,
+};
+
+static struct wmi_interface wmid_v2_interface = {
+	.type = ACER_WMID_v2,
+};
+
+/*
+ * WMID Gaming interface
+ */
+
+static struct wmi_interface wmid_gaming_interface = {
+	.type = ACER_WMID_GAMING
+};
+
+static const struct acer_cap_ops *acer_cap_ops_get(u32 cap);
+
+static acpi_status WMID_gaming_set_u64(u64 value, u32 cap)
+{
+	const struct acer_cap_ops *ops = acer_cap_ops_get(cap);
+
+	if (!(interface->capability & cap) || !ops || !ops->gaming_set_method)
+		return AE_BAD_PARAMETER;
+
+	return acer_wmi_exec_u64(ops->gaming_set_method, value, NULL);
+}
+
+static acpi_status WMID_gaming_set_u8_array(u8 array[], size_t array_size, u32 cap)
+{
+	switch (cap) {
+	case ACER_CAP_GAMINGKB:
+		if (array_size != ACER_WMI_SET_GAMINGKBBL_IN_LEN)
+			return AE_BAD_PARAMETER;
+		return acer_wmi_exec(ACER_WMI_SET_GAMINGKBBL, array, array_size,
+				     NULL, NULL);
+	default:
+		return AE_ERROR;
+	}
+}
+
+static acpi_status WMID_gaming_get_u64(u64 *value, u32 cap)
+{
+	if (!(interface->capability & cap))
+		return AE_BAD_PARAMETER;
+
+	switch (cap) {
+	case ACER_CAP_TURBO_LED:
+		return acer_wmi_call_u64(GET_GAMING_LED, 0x1, value);
+	default:
+		return AE_BAD_PARAMETER;
+	}
+}
+
+static acpi_status WMID_gaming_get_u8_array(u8 array[], size_t array_size, u32 cap)
+{
+	u8 config[ACER_WMI_LEN_KBBL];
+	acpi_status status;
+	u32 in = 0;
+
+	switch (cap) {
+	case ACER_CAP_GAMINGKB:
+		if (array_size > sizeof(config))
+			return AE_BAD_PARAMETER;
+		status = acer_wmi_exec(ACER_WMI_GET_GAMINGKBBL, &in, sizeof(in),
+				       NULL, config);
+		if (ACPI_SUCCESS(status))
+			memcpy(array, config, array_size);
+		return status;
+	default:
+		return AE_ERROR;
+	}
+}
+
+static void WMID_gaming_set_fan_mode(u8 fan_mode)
+{
+	/* fan_mode = 1 is used for auto, fan_mode = 2 used for turbo*/
+	u64 gpu_fan_config1 = 0, gpu_fan_config2 = 0;
+	int i;
+
+	if (quirks->cpu_fans > 0)
+		gpu_fan_config2 |= 1;
+	for (i = 0; i < (quirks->cpu_fans + quirks->gpu_fans); ++i)
+		gpu_fan_config2 |= 1 << (i + 1);
+	for (i = 0; i < quirks->gpu_fans; ++i)
+		gpu_fan_config2 |= 1 << (i + 3);
+	if (quirks->cpu_fans > 0)
+		gpu_fan_config1 |= fan_mode;
+	for (i = 0; i < (quirks->cpu_fans + quirks->gpu_fans); ++i)
+		gpu_fan_config1 |= fan_mode << (2 * i + 2);
+	for (i = 0; i < quirks->gpu_fans; ++i)
+		gpu_fan_config1 |= fan_mode << (2 * i + 6);
+	WMID_gaming_set_u64(gpu_fan_config2 | gpu_fan_config1 << 16, ACER_CAP_TURBO_FAN);
+}
+ 
+static int WMID_gaming_set_misc_setting(enum acer_wmi_gaming_misc_setting setting, u8 value)
+{
+	acpi_status status;
+	u64 input = 0;
+	u64 result;
+
+	input |= FIELD_PREP(ACER_GAMING_MISC_SETTING_INDEX_MASK, setting);
+	input |= FIELD_PREP(ACER_GAMING_MISC_SETTING_VALUE_MASK, value);
+
+	status = acer_wmi_call_u64(SET_GAMING_MISC, input, &result);
+	if (ACPI_FAILURE(status))
+		return -EIO;
+
+	/* The return status must be zero for the operation to have succeeded */
+	if (FIELD_GET(ACER_GAMING_MISC_SETTING_STATUS_MASK, result))
+		return -EIO;
+
+	return 0;
+}
+
+#if RTLNX_VER_MIN(6, 14, 0)
+static int WMID_gaming_get_misc_setting(enum acer_wmi_gaming_misc_setting setting, u8 *value)
+{
+	acpi_status status;
+	u32 input = 0;
+	u64 result;
+
+	input |= FIELD_PREP(ACER_GAMING_MISC_SETTING_INDEX_MASK, setting);
+
+	status = acer_wmi_call_u32(GET_GAMING_MISC, input, &result);
+	if (ACPI_FAILURE(status))
+		return -EIO;
+
+	/* The return status must be zero for the operation to have succeeded */
+	if (FIELD_GET(ACER_GAMING_MISC_SETTING_STATUS_MASK, result))
+		return -EIO;
+
+	*value = FIELD_GET(ACER_GAMING_MISC_SETTING_VALUE_MASK, result);
+
+	return 0;
+}
+#endif
+/*
+ * Generic Device (interface-independent)
+ * The handlers for each capability are picked once the interface is
+ * known, so accessing a device is a single indirect call.
+ */
+struct acer_cap_ops {
+	acpi_status (*get_u32)(u32 *value, u32 cap);
+	acpi_status (*set_u32)(u32 value, u32 cap);
+	acpi_status (*get_u8_array)(u8 array[], size_t array_size, u32 cap);
+	acpi_status (*set_u8_array)(u8 array[], size_t array_size, u32 cap);
+	enum acer_wmi_method gaming_set_method;	/* Method taking a u64 */
+};
+
+static struct acer_cap_ops acer_cap_ops[ACER_CAP_COUNT];
+
+/*
+ * On some models, some WMID methods don't toggle properly. For those
+ * cases, we want to run the AMW0 method afterwards to be certain we've
+ * really toggled the device state.
+ */
+static acpi_status AMW0_V2_set_rf_u32(u32 value, u32 cap)
+{
+	acpi_status status;
+
+	status = WMID_set_u32(value, cap);
+	if (ACPI_FAILURE(status))
+		return status;
+
+	return AMW0_set_u32(value, cap);
+}
+
+static void __init acer_cap_ops_init(void)
+{
+	struct acer_cap_ops *ops;
+	u32 cap;
+	int i;
+
+	for (i = 0; i < ACER_CAP_COUNT; i++) {
+		ops = &acer_cap_ops[i];
+		cap = BIT(i);
+
+		switch (interface->type) {
+		case ACER_AMW0:
+			ops->get_u32 = AMW0_get_u32;
+			ops->set_u32 = AMW0_set_u32;
+			break;
+		case ACER_AMW0_V2:
+			if (cap == ACER_CAP_MAILLED) {
+				ops->get_u32 = AMW0_get_u32;
+				ops->set_u32 = AMW0_set_u32;
+			} else if (cap == ACER_CAP_WIRELESS || cap == ACER_CAP_BLUETOOTH) {
+				ops->get_u32 = WMID_get_u32;
+				ops->set_u32 = AMW0_V2_set_rf_u32;
+			} else {
+				ops->get_u32 = WMID_get_u32;
+				ops->set_u32 = WMID_set_u32;
+			}
+			break;
+		case ACER_WMID:
+			ops->get_u32 = WMID_get_u32;
+			ops->set_u32 = WMID_set_u32;
+			break;
+		case ACER_WMID_v2:
+			if (cap & (ACER_CAP_WIRELESS |
+				   ACER_CAP_BLUETOOTH |
+				   ACER_CAP_THREEG)) {
+				ops->get_u32 = wmid_v2_get_u32;
+				ops->set_u32 = wmid_v2_set_u32;
+			} else if (has_guid(ACER_GUID_WMID_2)) {
+				ops->get_u32 = WMID_get_u32;
+				ops->set_u32 = WMID_set_u32;
+			}
+			break;
+		}
+
+		if (!gaming_interface)
+			continue;
+
+		switch (cap) {
+		case ACER_CAP_TURBO_LED:
+			ops->gaming_set_method = ACER_WMI_SET_GAMING_LED;
+			break;
+		case ACER_CAP_TURBO_FAN:
+			ops->gaming_set_method = ACER_WMI_SET_GAMING_FAN;
+			break;
+		case ACER_CAP_TURBO_OC:
+			ops->gaming_set_method = ACER_WMI_SET_GAMING_MISC;
+			break;
+		case ACER_CAP_GAMINGKB:
+			ops->get_u8_array = WMID_gaming_get_u8_array;
+			ops->set_u8_array = WMID_gaming_set_u8_array;
+			break;
+		}
+	}
+}
+
+/* cap must be a single capability flag */
+static const struct acer_cap_ops *acer_cap_ops_get(u32 cap)
+{
+	if (!is_power_of_2(cap) || __ffs(cap) >= ACER_CAP_COUNT)
+		return NULL;
+
+	return &acer_cap_ops[__ffs(cap)];
+}
+
+static acpi_status get_u32(u32 *value, u32 cap)
+{
+	const struct acer_cap_ops *ops = acer_cap_ops_get(cap);
+
+	if (!ops || !ops->get_u32)
+		return AE_ERROR;
+
+	return ops->get_u32(value, cap);
+}
+
+static acpi_status set_u32(u32 value, u32 cap)
+{
+	const struct acer_cap_ops *ops = acer_cap_ops_get(cap);
+
+	if (!(interface->capability & cap) || !ops || !ops->set_u32)
+		return AE_BAD_PARAMETER;
+
+	return ops->set_u32(value, cap);
+}
+
+static acpi_status set_u8_array(u8 array[], size_t array_size, u32 cap)
+{
+	const struct acer_cap_ops *ops = acer_cap_ops_get(cap);
+
+	if (!ops || !ops->set_u8_array || !(gaming_interface->capability & cap))
+		return AE_BAD_PARAMETER;
+
+	return ops->set_u8_array(array, array_size, cap);
+}
+
+static acpi_status get_u8_array(u8 array[], size_t array_size, u32 cap)
+{
+	const struct acer_cap_ops *ops = acer_cap_ops_get(cap);
+
+	if (!ops || !ops->get_u8_array || !(gaming_interface->capability & cap))
+		return AE_BAD_PARAMETER;
+
+	return ops->get_u8_array(array, array_size, cap);
+}
+
+static void __init acer_commandline_init(void)
+{
+	/*
+	 * These will all fail silently if the value given is invalid, or the
+	 * capability isn't available on the given interface
+	 */
+	if (mailled >= 0)
+		set_u32(mailled, ACER_CAP_MAILLED);
+	if (!has_type_aa && threeg >= 0)
+		set_u32(threeg, ACER_CAP_THREEG);
+	if (brightness >= 0)
+		set_u32(brightness, ACER_CAP_BRIGHTNESS);
+}
+
+/*
+ * LED device (Mail LED only, no other LEDs known yet)
+ */
+static void mail_led_set(struct led_classdev *led_cdev,
+enum led_brightness value)
+{
+	set_u32(value, ACER_CAP_MAILLED);
+}
+
+static struct led_classdev mail_led = {
+	.name = "acer-wmi::mail",
+	.brightness_set = mail_led_set,
+};
+
+static int acer_led_init(struct device *dev)
+{
+	return led_classdev_register(dev, &mail_led);
+}
+
+static void acer_led_exit(void)
+{
+	set_u32(LED_OFF, ACER_CAP_MAILLED);
+	led_classdev_unregister(&mail_led);
+}
+
+/*
+ * Driver state
+ * State shared by the WMI notify handler, sysfs, the platform profile
+ * callbacks and the character devices is guarded per subsystem, so a
+ * slow keyboard backlight call (serialized by gkbbl_shadow.lock) never
+ * waits for a profile switch or a radio toggle.
+ * Read-mostly values are also published in acer_state, which readers
+ * copy under a seqlock without blocking writers.
+ */
+static DEFINE_MUTEX(acer_thermal_lock);	/* turbo, profiles, fan mode */
+static DEFINE_MUTEX(acer_radio_lock);	/* wireless, bluetooth, 3G */
+
+struct acer_state {
+	int profile;		/* enum platform_profile_option, -1 if unknown */
+	bool turbo;
+	u8 macro_key;
+	int fan_rpm[2];		/* Last speeds read, -1 if unknown */
+	bool gkbbl_known;
+	u8 gkbbl_config[GAMING_KBBL_CONFIG_LEN];
+};
+
+static DEFINE_SEQLOCK(acer_state_lock);
+static struct acer_state acer_state = {
+	.profile = -1,
+	.fan_rpm = { -1, -1 },
+};
+
+#define acer_state_set(field, value)			\
+	do {						\
+		write_seqlock(&acer_state_lock);	\
+		acer_state.field = (value);		\
+		write_sequnlock(&acer_state_lock);	\
+	} while (0)
+
+static void acer_state_set_gkbbl(const u8 *config)
+{
+	write_seqlock(&acer_state_lock);
+	memcpy(acer_state.gkbbl_config, config, GAMING_KBBL_CONFIG_LEN);
+	acer_state.gkbbl_known = true;
+	write_sequnlock(&acer_state_lock);
+}
+
+static void acer_state_get(struct acer_state *state)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&acer_state_lock);
+		*state = acer_state;
+	} while (read_seqretry(&acer_state_lock, seq));
+}
+
+/*
+ * Shadow copy of the keyboard backlight state last applied successfully.
+ * Writes identical to it are answered without touching ACPI, unless
+ * gkbbl_write_through is set. The lock also serializes all keyboard
+ * backlight firmware calls.
+ * dynamic_known tells whether dynamic can be reported to user space,
+ * dynamic_valid whether it's still trusted for skipping writes. Only
+ * configs this driver wrote are trusted: the GET_GAMINGKBBL layout isn't
+ * known to match the SET one, so a readback is reported but never used to
+ * skip a write.
+ */
+struct gkbbl_shadow_data {
+	struct mutex lock;
+	u8 dynamic[GAMING_KBBL_CONFIG_LEN];
+	bool dynamic_known;
+	bool dynamic_valid;
+	u8 zone_rgb[GAMING_KBBL_STATIC_MAX_ZONES][3];
+	u8 zones_valid;
+
+	/* Statistics, exported through debugfs */
+	u64 hits;
+	u64 misses;
+};
+
+static struct gkbbl_shadow_data gkbbl_shadow = {
+	.lock = __MUTEX_INITIALIZER(gkbbl_shadow.lock),
+};
+
+static void gkbbl_shadow_invalidate(void)
+{
+	mutex_lock(&gkbbl_shadow.lock);
+	gkbbl_shadow.dynamic_valid = false;
+	gkbbl_shadow.zones_valid = 0;
+	mutex_unlock(&gkbbl_shadow.lock);
+}
+
+/* Fill the shadow copy from the firmware, on load and after resume */
+static void gkbbl_shadow_readback(void)
+{
+	struct gkbbl_shadow_data *shadow = &gkbbl_shadow;
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+	acpi_status status;
+
+	mutex_lock(&shadow->lock);
+	status = get_u8_array(config, GAMING_KBBL_CONFIG_LEN, ACER_CAP_GAMINGKB);
+	if (ACPI_SUCCESS(status)) {
+		memcpy(shadow->dynamic, config, GAMING_KBBL_CONFIG_LEN);
+		shadow->dynamic_known = true;
+		shadow->dynamic_valid = false;
+		acer_state_set_gkbbl(config);
+	} else {
+		pr_warn("Unable to read keyboard backlight config: %s\n",
+			acpi_format_exception(status));
+	}
+	mutex_unlock(&shadow->lock);
+}
+
+/*
+ * Returns false if the current config isn't known. Doesn't wait for a
+ * firmware call in progress.
+ */
+static bool gkbbl_shadow_get_config(u8 *config)
+{
+	unsigned int seq;
+	bool known;
+
+	do {
+		seq = read_seqbegin(&acer_state_lock);
+		known = acer_state.gkbbl_known;
+		if (known)
+			memcpy(config, acer_state.gkbbl_config, GAMING_KBBL_CONFIG_LEN);
+	} while (read_seqretry(&acer_state_lock, seq));
+
+	return known;
+}
+
+/*
+ * Apply a dynamic config. The status of the firmware call, or AE_OK if it
+ * was skipped, is stored in fw_status when given.
+ */
+static int gkbbl_apply_config(const u8 *config, acpi_status *fw_status)
+{
+	struct gkbbl_shadow_data *shadow = &gkbbl_shadow;
+	acpi_status status = AE_OK;
+	int err = 0;
+
+	mutex_lock(&shadow->lock);
+	if (!READ_ONCE(gkbbl_write_through) && shadow->dynamic_valid &&
+	    !memcmp(shadow->dynamic, config, GAMING_KBBL_CONFIG_LEN)) {
+		shadow->hits++;
+		goto out;
+	}
+
+	shadow->misses++;
+	status = set_u8_array((u8 *)config, GAMING_KBBL_CONFIG_LEN, ACER_CAP_GAMINGKB);
+	if (ACPI_FAILURE(status)) {
+		shadow->dynamic_valid = false;
+		err = -EIO;
+		goto out;
+	}
+
+	memcpy(shadow->dynamic, config, GAMING_KBBL_CONFIG_LEN);
+	shadow->dynamic_known = true;
+	shadow->dynamic_valid = true;
+	acer_state_set_gkbbl(config);
+out:
+	mutex_unlock(&shadow->lock);
+	if (fw_status)
+		*fw_status = status;
+	return err;
+}
+
+/*
+ * Keyboard RGB backlight character device handler.
+ * On systems supporting Acer gaming functions, a char device
+ * will be exposed to communicate with user space
+ * for keyboard RGB backlight configurations.
+ */
+
+/*
+ * Write coalescing for the dynamic keyboard backlight.
+ * When gkbbl_coalesce is set, a write only replaces the pending config and
+ * returns. A delayed work applies the newest pending config at most
+ * gkbbl_max_rate times per second, configs replaced before being applied
+ * are dropped.
+ */
+struct gkbbl_coalesce_data {
+	spinlock_t lock;
+	u8 pending[GAMING_KBBL_CONFIG_LEN];
+	bool dirty;
+	unsigned long last_apply;
+	struct delayed_work work;
+
+	/* Statistics, exported through debugfs */
+	u64 submitted;
+	u64 applied;
+	u64 dropped;
+};
+
+static void gkbbl_coalesce_work(struct work_struct *work);
+
+static struct gkbbl_coalesce_data gkbbl_coalesce_data = {
+	.lock = __SPIN_LOCK_UNLOCKED(gkbbl_coalesce_data.lock),
+	.work = __DELAYED_WORK_INITIALIZER(gkbbl_coalesce_data.work,
+					   gkbbl_coalesce_work, 0),
+};
+
+static unsigned long gkbbl_coalesce_interval(void)
+{
+	unsigned int rate = READ_ONCE(gkbbl_max_rate);
+
+	if (!rate)
+		return 0;
+
+	return DIV_ROUND_UP(HZ, rate);
+}
+
+/* Must be called with the coalescing lock held, releases it */
+static void gkbbl_coalesce_apply_pending(struct gkbbl_coalesce_data *data)
+	__releases(&data->lock)
+{
+	u8 config_buf[GAMING_KBBL_CONFIG_LEN];
+
+	memcpy(config_buf, data->pending, GAMING_KBBL_CONFIG_LEN);
+	data->dirty = false;
+	spin_unlock(&data->lock);
+
+	gkbbl_apply_config(config_buf, NULL);
+
+	spin_lock(&data->lock);
+	data->applied++;
+	data->last_apply = jiffies;
+	spin_unlock(&data->lock);
+}
+
+static void gkbbl_coalesce_work(struct work_struct *work)
+{
+	struct gkbbl_coalesce_data *data = &gkbbl_coalesce_data;
+	unsigned long next;
+
+	spin_lock(&data->lock);
+	if (!data->dirty) {
+		spin_unlock(&data->lock);
+		return;
+	}
+
+	/* Rate limit also applies when a submit raced with the last apply */
+	next = data->last_apply + gkbbl_coalesce_interval();
+	if (time_before(jiffies, next)) {
+		spin_unlock(&data->lock);
+		schedule_delayed_work(&data->work, next - jiffies);
+		return;
+	}
+
+	gkbbl_coalesce_apply_pending(data);
+}
+
+/* Apply the pending config right away, ignoring the rate limit */
+static void gkbbl_coalesce_flush(void)
+{
+	struct gkbbl_coalesce_data *data = &gkbbl_coalesce_data;
+
+	cancel_delayed_work_sync(&data->work);
+
+	spin_lock(&data->lock);
+	if (!data->dirty) {
+		spin_unlock(&data->lock);
+		return;
+	}
+
+	gkbbl_coalesce_apply_pending(data);
+}
+
+static void gkbbl_coalesce_submit(const u8 *config)
+{
+	struct gkbbl_coalesce_data *data = &gkbbl_coalesce_data;
+	unsigned long next, delay = 0;
+
+	spin_lock(&data->lock);
+	data->submitted++;
+	if (data->dirty)
+		data->dropped++;
+	memcpy(data->pending, config, GAMING_KBBL_CONFIG_LEN);
+	data->dirty = true;
+
+	next = data->last_apply + gkbbl_coalesce_interval();
+	if (time_before(jiffies, next))
+		delay = next - jiffies;
+	spin_unlock(&data->lock);
+
+	/* Does nothing if already queued, the newest config is picked up then */
+	schedule_delayed_work(&data->work, delay);
+}
+
+static int gkbbl_static_set_zones(const struct led_zone_set_param *params, size_t count,
+				  acpi_status *fw_status);
+
+/*
+ * Asynchronous submissions.
+ * A write on a file with O_NONBLOCK set doesn't wait for the firmware, the
+ * request is queued on an ordered workqueue and the write returns. read()
+ * returns a completion record per request, poll() reports queue room and
+ * pending records, and fsync() waits until all queued requests reached the
+ * firmware. Unread completion records count against the queue depth.
+ */
+#define GAMING_KBBL_ASYNC_DEPTH 16
+
+struct gkbbl_completion {
+	u64 seq;		/* Write order on this file, starting at 1 */
+	s32 error;		/* 0 or negative errno */
+	u32 firmware_status;	/* acpi_status of the last firmware call */
+	u64 queue_ns;		/* Time spent waiting in the queue */
+	u64 apply_ns;		/* Time spent applying the request */
+};
+
+struct gkbbl_file {
+	bool is_static;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	unsigned int inflight;
+	u64 next_seq;
+	DECLARE_KFIFO(done, struct gkbbl_completion, GAMING_KBBL_ASYNC_DEPTH);
+};
+
+struct gkbbl_request {
+	struct work_struct work;
+	struct gkbbl_file *ctx;
+	u64 seq;
+	u64 submit_ns;
+	size_t count;
+	union {
+		u8 config[GAMING_KBBL_CONFIG_LEN];
+		struct led_zone_set_param zones[GAMING_KBBL_STATIC_MAX_ZONES];
+	};
+};
+
+static struct workqueue_struct *gkbbl_wq;
+
+static void gkbbl_request_work(struct work_struct *work)
+{
+	struct gkbbl_request *req = container_of(work, struct gkbbl_request, work);
+	struct gkbbl_file *ctx = req->ctx;
+	struct gkbbl_completion done = { .seq = req->seq };
+	acpi_status fw_status = AE_OK;
+	u64 start = ktime_get_ns();
+
+	if (ctx->is_static)
+		done.error = gkbbl_static_set_zones(req->zones, req->count, &fw_status);
+	else
+		done.error = gkbbl_apply_config(req->config, &fw_status);
+
+	done.firmware_status = fw_status;
+	done.queue_ns = start - req->submit_ns;
+	done.apply_ns = ktime_get_ns() - start;
+
+	/* Wake under the lock, release() frees the context once it is dropped */
+	spin_lock(&ctx->lock);
+	kfifo_put(&ctx->done, done);
+	ctx->inflight--;
+	wake_up(&ctx->wait);
+	spin_unlock(&ctx->lock);
+
+	kfree(req);
+}
+
+static int gkbbl_async_submit(struct gkbbl_file *ctx, const void *payload, size_t len,
+			      size_t count)
+{
+	struct gkbbl_request *req;
+
+	/* No workqueue if the dynamic device failed to initialise */
+	if (!gkbbl_wq)
+		return -EOPNOTSUPP;
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	spin_lock(&ctx->lock);
+	if (ctx->inflight + kfifo_len(&ctx->done) >= GAMING_KBBL_ASYNC_DEPTH) {
+		spin_unlock(&ctx->lock);
+		kfree(req);
+		return -EAGAIN;
+	}
+	ctx->inflight++;
+	req->seq = ++ctx->next_seq;
+	spin_unlock(&ctx->lock);
+
+	INIT_WORK(&req->work, gkbbl_request_work);
+	req->ctx = ctx;
+	req->count = count;
+	req->submit_ns = ktime_get_ns();
+	memcpy(&req->config, payload, len);
+
+	queue_work(gkbbl_wq, &req->work);
+	return 0;
+}
+
+static int gkbbl_file_open(struct file *file, bool is_static)
+{
+	struct gkbbl_file *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->is_static = is_static;
+	spin_lock_init(&ctx->lock);
+	init_waitqueue_head(&ctx->wait);
+	INIT_KFIFO(ctx->done);
+
+	file->private_data = ctx;
+	return nonseekable_open(file_inode(file), file);
+}
+
+static int gkbbl_drv_release(struct inode *inode, struct file *file)
+{
+	struct gkbbl_file *ctx = file->private_data;
+
+	/* Queued requests still reference the context */
+	wait_event(ctx->wait, !READ_ONCE(ctx->inflight));
+	spin_lock(&ctx->lock);
+	spin_unlock(&ctx->lock);
+	kfree(ctx);
+
+	return 0;
+}
+
+/*
+ * read() only returns completion records of asynchronous writes, blocking
+ * until one is available. The current config is read with
+ * GAMING_KBBL_IOC_GET_CONFIG.
+ */
+static ssize_t gkbbl_drv_read(struct file *file, char __user *buf, size_t count,
+			      loff_t *offset)
+{
+	struct gkbbl_file *ctx = file->private_data;
+	struct gkbbl_completion records[GAMING_KBBL_ASYNC_DEPTH];
+	size_t nr, max = min_t(size_t, count / sizeof(records[0]),
+			       GAMING_KBBL_ASYNC_DEPTH);
+	int err;
+
+	if (!max)
+		return -EINVAL;
+
+	if (kfifo_is_empty(&ctx->done)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(ctx->wait,
+					       !kfifo_is_empty(&ctx->done) ||
+					       !READ_ONCE(ctx->inflight));
+		if (err)
+			return err;
+	}
+
+	spin_lock(&ctx->lock);
+	for (nr = 0; nr < max; nr++) {
+		if (!kfifo_get(&ctx->done, &records[nr]))
+			break;
+	}
+	spin_unlock(&ctx->lock);
+
+	/* Room in the queue was freed */
+	if (nr)
+		wake_up(&ctx->wait);
+
+	if (copy_to_user(buf, records, nr * sizeof(records[0])))
+		return -EFAULT;
+
+	return nr * sizeof(records[0]);
 }
 
-static acpi_status wmid3_set_device_status(u32 value, u16 device)
+static __poll_t gkbbl_drv_poll(struct file *file, poll_table *wait)
 {
-	struct wmid3_gds_return_value return_value;
-	acpi_status status;
-	union acpi_object *obj;
-	u16 devices;
-	struct wmid3_gds_get_input_param get_params = {
-		.function_num = 0x1,
-		.hotkey_number = commun_fn_key_number,
-		.devices = commun_func_bitmap,
-	};
-	struct acpi_buffer get_input = {
-		sizeof(struct wmid3_gds_get_input_param),
-		&get_params
-	};
-	struct wmid3_gds_set_input_param set_params = {
-		.function_num = 0x2,
-		.hotkey_number = commun_fn_key_number,
-		.devices = commun_func_bitmap,
-	};
-	struct acpi_buffer set_input = {
-		sizeof(struct wmid3_gds_set_input_param),
-		&set_params
-	};
-	struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
-	struct acpi_buffer output2 = { ACPI_ALLOCATE_BUFFER, NULL };
+	struct gkbbl_file *ctx = file->private_data;
+	__poll_t mask = 0;
 
-	status = wmi_evaluate_method(WMID_GUID3, 0, 0x2, &get_input, &output);
-	if (ACPI_FAILURE(status))
-		return status;
+	poll_wait(file, &ctx->wait, wait);
 
-	obj = output.pointer;
+	spin_lock(&ctx->lock);
+	if (!kfifo_is_empty(&ctx->done))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (ctx->inflight + kfifo_len(&ctx->done) < GAMING_KBBL_ASYNC_DEPTH)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	spin_unlock(&ctx->lock);
 
-	if (!obj)
-		return AE_ERROR;
-	else if (obj->type != ACPI_TYPE_BUFFER) {
-		kfree(obj);
-		return AE_ERROR;
+	return mask;
+}
+
+static int gkbbl_drv_fsync(struct file *file, loff_t start, loff_t end, int datasync)
+{
+	struct gkbbl_file *ctx = file->private_data;
+
+	if (!ctx->is_static)
+		gkbbl_coalesce_flush();
+
+	return wait_event_interruptible(ctx->wait, !READ_ONCE(ctx->inflight));
+}
+
+static int gkbbl_drv_open(struct inode *inode, struct file *file)
+{
+	return gkbbl_file_open(file, false);
+}
+
+static ssize_t gkbbl_drv_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *offset)
+{
+	struct gkbbl_coalesce_data *data = &gkbbl_coalesce_data;
+	u8 config_buf[GAMING_KBBL_CONFIG_LEN];
+	int err;
+
+	if (count != GAMING_KBBL_CONFIG_LEN) {
+		pr_err("Invalid data given to gaming keyboard backlight\n");
+		return -EINVAL;
 	}
-	if (obj->buffer.length != 8) {
-		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
-		kfree(obj);
-		return AE_ERROR;
+
+	if (copy_from_user(config_buf, buf, GAMING_KBBL_CONFIG_LEN))
+		return -EFAULT;
+
+	trace_acer_gkbbl_submit("dynamic", config_buf, GAMING_KBBL_CONFIG_LEN,
+				file->f_flags & O_NONBLOCK);
+
+	if (file->f_flags & O_NONBLOCK) {
+		err = gkbbl_async_submit(file->private_data, config_buf,
+					 GAMING_KBBL_CONFIG_LEN, 1);
+		return err ? err : count;
 	}
 
-	return_value = *((struct wmid3_gds_return_value *)obj->buffer.pointer);
-	kfree(obj);
+	if (READ_ONCE(gkbbl_coalesce)) {
+		gkbbl_coalesce_submit(config_buf);
+		return count;
+	}
 
-	if (return_value.error_code || return_value.ec_return_value) {
-		pr_warn("Get Current Device Status failed: 0x%x - 0x%x\n",
-			return_value.error_code,
-			return_value.ec_return_value);
-		return status;
+	err = gkbbl_apply_config(config_buf, NULL);
+
+	spin_lock(&data->lock);
+	data->submitted++;
+	if (!err)
+		data->applied++;
+	data->last_apply = jiffies;
+	spin_unlock(&data->lock);
+
+	return err ? err : count;
+}
+
+
+static struct gkbbl_shared_state *gkbbl_shared_page;
+static DEFINE_MUTEX(gkbbl_doorbell_lock);
+
+static int gkbbl_doorbell(void)
+{
+	struct gkbbl_shared_state *shared = gkbbl_shared_page;
+	struct led_zone_set_param zones[GAMING_KBBL_STATIC_MAX_ZONES];
+	struct led_zone_set_param snapshot[GAMING_KBBL_STATIC_MAX_ZONES];
+	u8 effect[GAMING_KBBL_CONFIG_LEN];
+	int retries = 3;
+	size_t i, nr_zones = 0;
+	u32 seq, flags;
+	int err = 0;
+
+	mutex_lock(&gkbbl_doorbell_lock);
+
+	/* Retry while user space is writing, seq is odd then, or was meanwhile */
+	for (;;) {
+		seq = READ_ONCE(shared->seq);
+		smp_rmb();
+		flags = READ_ONCE(shared->flags);
+		memcpy(effect, shared->effect, sizeof(effect));
+		memcpy(snapshot, shared->zones, sizeof(snapshot));
+		smp_rmb();
+		if (!(seq & 1) && READ_ONCE(shared->seq) == seq)
+			break;
+		if (!--retries)
+			break;
+		cpu_relax();
 	}
 
-	devices = return_value.devices;
-	set_params.devices = (value) ? (devices | device) : (devices & ~device);
+	if (!retries) {
+		err = -EAGAIN;
+		goto out;
+	}
 
-	status = wmi_evaluate_method(WMID_GUID3, 0, 0x1, &set_input, &output2);
-	if (ACPI_FAILURE(status))
-		return status;
+	if (seq == READ_ONCE(shared->applied_seq))
+		goto out;
 
-	obj = output2.pointer;
+	for (i = 0; i < GAMING_KBBL_STATIC_MAX_ZONES; i++) {
+		if (snapshot[i].zone)
+			zones[nr_zones++] = snapshot[i];
+	}
 
-	if (!obj)
-		return AE_ERROR;
-	else if (obj->type != ACPI_TYPE_BUFFER) {
-		kfree(obj);
-		return AE_ERROR;
+	if ((flags & GAMING_KBBL_SHARED_ZONES) && nr_zones)
+		err = gkbbl_static_set_zones(zones, nr_zones, NULL);
+
+	if (!err && (flags & GAMING_KBBL_SHARED_EFFECT))
+		err = gkbbl_apply_config(effect, NULL);
+
+	if (!err)
+		WRITE_ONCE(shared->applied_seq, seq);
+out:
+	mutex_unlock(&gkbbl_doorbell_lock);
+	return err;
+}
+
+static int gkbbl_drv_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	/* Stores to a private copy would never reach the driver */
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	#if RTLNX_VER_MIN(6, 3, 0)
+	vm_flags_mod(vma, VM_DONTEXPAND, VM_MAYEXEC);
+	#else
+	vma->vm_flags |= VM_DONTEXPAND;
+	vma->vm_flags &= ~VM_MAYEXEC;
+	#endif
+
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(gkbbl_shared_page));
+}
+
+static bool gkbbl_reserved_clear(const u8 *reserved, size_t len)
+{
+	return !memchr_inv(reserved, 0, len);
+}
+
+static int gkbbl_effect_to_config(const struct gkbbl_effect *effect, u8 *config)
+{
+	if (effect->version != GAMING_KBBL_API_VERSION ||
+	    effect->mode > GAMING_KBBL_MAX_MODE ||
+	    effect->speed > GAMING_KBBL_MAX_SPEED ||
+	    effect->brightness > GAMING_KBBL_MAX_BRIGHTNESS ||
+	    effect->direction > GAMING_KBBL_MAX_DIRECTION ||
+	    !gkbbl_reserved_clear(effect->reserved, sizeof(effect->reserved)))
+		return -EINVAL;
+
+	memset(config, 0, GAMING_KBBL_CONFIG_LEN);
+	config[0] = effect->mode;
+	config[1] = effect->speed;
+	config[2] = effect->brightness;
+	/* Wave needs this, PredatorSense sends it for no other mode */
+	config[3] = effect->mode == 3 ? 8 : 0;
+	config[4] = effect->direction;
+	config[5] = effect->red;
+	config[6] = effect->green;
+	config[7] = effect->blue;
+	config[9] = 1;
+
+	return 0;
+}
+
+static int gkbbl_zones_check(const struct gkbbl_zones *zones)
+{
+	u32 i;
+
+	if (zones->version != GAMING_KBBL_API_VERSION ||
+	    !zones->count || zones->count > GAMING_KBBL_STATIC_MAX_ZONES)
+		return -EINVAL;
+
+	for (i = 0; i < zones->count; i++) {
+		if (!zones->zones[i].zone)
+			return -EINVAL;
 	}
-	if (obj->buffer.length != 4) {
-		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
-		kfree(obj);
-		return AE_ERROR;
+
+	return 0;
+}
+
+static int gkbbl_ioctl_set_effect(void __user *argp)
+{
+	struct gkbbl_effect effect;
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+	int err;
+
+	if (copy_from_user(&effect, argp, sizeof(effect)))
+		return -EFAULT;
+
+	trace_acer_gkbbl_submit("ioctl_effect", &effect, sizeof(effect), false);
+
+	err = gkbbl_effect_to_config(&effect, config);
+	if (err)
+		return err;
+
+	return gkbbl_apply_config(config, NULL);
+}
+
+static int gkbbl_ioctl_set_zones(void __user *argp)
+{
+	struct gkbbl_zones zones;
+	int err;
+
+	if (copy_from_user(&zones, argp, sizeof(zones)))
+		return -EFAULT;
+
+	trace_acer_gkbbl_submit("ioctl_zones", &zones, sizeof(zones), false);
+
+	err = gkbbl_zones_check(&zones);
+	if (err)
+		return err;
+
+	return gkbbl_static_set_zones(zones.zones, zones.count, NULL);
+}
+
+static int gkbbl_ioctl_set_static(void __user *argp)
+{
+	struct gkbbl_static req;
+	struct gkbbl_effect effect = {
+		.version = GAMING_KBBL_API_VERSION,
+	};
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+	int err;
+
+	if (copy_from_user(&req, argp, sizeof(req)))
+		return -EFAULT;
+
+	trace_acer_gkbbl_submit("ioctl_static", &req, sizeof(req), false);
+
+	if (req.version != GAMING_KBBL_API_VERSION ||
+	    !gkbbl_reserved_clear(req.reserved, sizeof(req.reserved)))
+		return -EINVAL;
+
+	err = gkbbl_zones_check(&req.zones);
+	if (err)
+		return err;
+
+	effect.brightness = req.brightness;
+	err = gkbbl_effect_to_config(&effect, config);
+	if (err)
+		return err;
+
+	err = gkbbl_static_set_zones(req.zones.zones, req.zones.count, NULL);
+	if (err)
+		return err;
+
+	return gkbbl_apply_config(config, NULL);
+}
+
+static int gkbbl_ioctl_get_config(void __user *argp)
+{
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+
+	if (!gkbbl_shadow_get_config(config))
+		return -ENODATA;
+
+	if (copy_to_user(argp, config, sizeof(config)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static long gkbbl_drv_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case GAMING_KBBL_IOC_GET_CONFIG:
+		return gkbbl_ioctl_get_config(argp);
+	case GAMING_KBBL_IOC_DOORBELL:
+		return gkbbl_doorbell();
+	case GAMING_KBBL_IOC_SET_EFFECT:
+		return gkbbl_ioctl_set_effect(argp);
+	case GAMING_KBBL_IOC_SET_ZONES:
+		return gkbbl_ioctl_set_zones(argp);
+	case GAMING_KBBL_IOC_SET_STATIC:
+		return gkbbl_ioctl_set_static(argp);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations gkbbl_dev_fops = {
+		.owner      = THIS_MODULE,
+		.open        = gkbbl_drv_open,
+		.release     = gkbbl_drv_release,
+		.read        = gkbbl_drv_read,
+		.write       = gkbbl_drv_write,
+		.poll        = gkbbl_drv_poll,
+		.fsync       = gkbbl_drv_fsync,
+		.mmap        = gkbbl_drv_mmap,
+		.unlocked_ioctl = gkbbl_drv_ioctl,
+		.compat_ioctl = compat_ptr_ioctl,
+};
+
+static ssize_t config_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+
+	if (!gkbbl_shadow_get_config(config))
+		return -ENODATA;
+
+	return sysfs_emit(buf, "%*phN\n", GAMING_KBBL_CONFIG_LEN, config);
+}
+static DEVICE_ATTR_RO(config);
+
+static struct attribute *gkbbl_dev_attrs[] = {
+	&dev_attr_config.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(gkbbl_dev);
+
+struct gkbbl_device_data {
+	struct cdev cdev;
+};
+
+static struct class *gkbbl_dev_class;
+static struct gkbbl_device_data gkbbl_dev_data;
+
+static int gkbbl_dev_uevent(
+#if RTLNX_VER_MIN(6, 2, 0)
+const
+#endif
+struct device *dev, struct kobj_uevent_env *env)
+{
+	add_uevent_var(env, "DEVMODE=%#o", 0666);
+	return 0;
+}
+
+static int __init gaming_kbbl_cdev_init(void)
+{
+	dev_t dev;
+	int err;
+
+	BUILD_BUG_ON(sizeof(struct gkbbl_shared_state) > PAGE_SIZE);
+
+	/* Shared by both keyboard backlight devices */
+	gkbbl_wq = alloc_ordered_workqueue("acer-gkbbl", 0);
+	if (!gkbbl_wq)
+		return -ENOMEM;
+
+	gkbbl_shared_page = (struct gkbbl_shared_state *)get_zeroed_page(GFP_KERNEL);
+	if (!gkbbl_shared_page) {
+		err = -ENOMEM;
+		goto err_destroy_wq;
+	}
+
+	err = alloc_chrdev_region(&dev, 0, 1, GAMING_KBBL_CHR);
+	if (err < 0) {
+		pr_err("Char drive registering for gaming keyboard backlight failed: %d\n", err);
+		goto err_free_page;
 	}
 
-	return_value = *((struct wmid3_gds_return_value *)obj->buffer.pointer);
-	kfree(obj);
+	gkbbl_dynamic_dev = dev;
+
+	#if RTLNX_VER_MIN(6, 4, 0)
+		gkbbl_dev_class = class_create(GAMING_KBBL_CHR);
+	#else
+		gkbbl_dev_class = class_create(THIS_MODULE, GAMING_KBBL_CHR);
+	#endif
+
+	gkbbl_dev_class->dev_uevent = gkbbl_dev_uevent;
+
+	cdev_init(&gkbbl_dev_data.cdev, &gkbbl_dev_fops);
+	gkbbl_dev_data.cdev.owner = THIS_MODULE;
+
+	cdev_add(&gkbbl_dev_data.cdev, gkbbl_dynamic_dev, 1);
+
+	gkbbl_shadow_readback();
+
+	device_create_with_groups(gkbbl_dev_class, NULL, gkbbl_dynamic_dev, NULL,
+				  gkbbl_dev_groups, "%s-%d",
+				  GAMING_KBBL_CHR,
+				  GAMING_KBBL_MINOR);
+
+	return 0;
+
+err_free_page:
+	free_page((unsigned long)gkbbl_shared_page);
+	gkbbl_shared_page = NULL;
+err_destroy_wq:
+	destroy_workqueue(gkbbl_wq);
+	gkbbl_wq = NULL;
+	return err;
+}
+
+static void __exit gaming_kbbl_cdev_exit(void)
+{
+	cancel_delayed_work_sync(&gkbbl_coalesce_data.work);
+
+	device_destroy(gkbbl_dev_class, gkbbl_dynamic_dev);
+
+	class_unregister(gkbbl_dev_class);
+	class_destroy(gkbbl_dev_class);
+	cdev_del(&gkbbl_dev_data.cdev);
+
+	unregister_chrdev_region(gkbbl_dynamic_dev, 1);
+
+	free_page((unsigned long)gkbbl_shared_page);
+	if (gkbbl_wq)
+		destroy_workqueue(gkbbl_wq);
+}
+
+/*
+ * Keyboard RGB backlight character device handler.
+ * On systems supporting Acer gaming functions, a char device
+ * will be exposed to communicate with user space
+ * for keyboard RGB backlight configurations.
+ * Similar to above, but for handling static coloring
+ */
+
 
-	if (return_value.error_code || return_value.ec_return_value)
-		pr_warn("Set Device Status failed: 0x%x - 0x%x\n",
-			return_value.error_code,
-			return_value.ec_return_value);
+/* True if every zone of the record already shows its colour */
+static bool gkbbl_static_shadow_match(const struct led_zone_set_param *param)
+{
+	unsigned long zones = param->zone;
+	unsigned int bit;
 
-	return status;
+	lockdep_assert_held(&gkbbl_shadow.lock);
+
+	if ((gkbbl_shadow.zones_valid & param->zone) != param->zone)
+		return false;
+
+	for_each_set_bit(bit, &zones, GAMING_KBBL_STATIC_MAX_ZONES) {
+		if (gkbbl_shadow.zone_rgb[bit][0] != param->red ||
+		    gkbbl_shadow.zone_rgb[bit][1] != param->green ||
+		    gkbbl_shadow.zone_rgb[bit][2] != param->blue)
+			return false;
+	}
+
+	return true;
 }
 
-static acpi_status wmid_v2_set_u32(u32 value, u32 cap)
+/* Record the colour of the record's zones after a successful write */
+static void gkbbl_static_shadow_update(const struct led_zone_set_param *param)
 {
-	u16 device;
+	unsigned long zones = param->zone;
+	unsigned int bit;
 
-	switch (cap) {
-	case ACER_CAP_WIRELESS:
-		device = ACER_WMID3_GDS_WIRELESS;
-		break;
-	case ACER_CAP_BLUETOOTH:
-		device = ACER_WMID3_GDS_BLUETOOTH;
-		break;
-	case ACER_CAP_THREEG:
-		device = ACER_WMID3_GDS_THREEG;
-		break;
-	default:
-		return AE_ERROR;
+	lockdep_assert_held(&gkbbl_shadow.lock);
+
+	for_each_set_bit(bit, &zones, GAMING_KBBL_STATIC_MAX_ZONES) {
+		gkbbl_shadow.zone_rgb[bit][0] = param->red;
+		gkbbl_shadow.zone_rgb[bit][1] = param->green;
+		gkbbl_shadow.zone_rgb[bit][2] = param->blue;
 	}
-	return wmid3_set_device_status(value, device);
+	gkbbl_shadow.zones_valid |= param->zone;
+
+	/*
+	 * The firmware may need the dynamic config to be written again before
+	 * new static colours show up, so never skip the next one.
+	 */
+	gkbbl_shadow.dynamic_valid = false;
 }
 
-static void __init type_aa_dmi_decode(const struct dmi_header *header, void *d)
+/*
+ * Apply a batch of zone records with as few firmware calls as possible.
+ * The zone byte is a bitmask, so records sharing a colour are merged into a
+ * single call. A later record always wins over an earlier one for the same
+ * zone bit, as if the records had been written one by one.
+ * The status of the last firmware call, or AE_OK if all were skipped, is
+ * stored in fw_status when given.
+ */
+static int gkbbl_static_set_zones(const struct led_zone_set_param *params, size_t count,
+				  acpi_status *fw_status)
 {
-	struct hotkey_function_type_aa *type_aa;
+	struct led_zone_set_param merged[GAMING_KBBL_STATIC_MAX_ZONES];
+	acpi_status status = AE_OK;
+	size_t i, j, nr_merged = 0;
+	int err = 0;
 
-	/* We are looking for OEM-specific Type AAh */
-	if (header->type != 0xAA)
-		return;
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < nr_merged; j++)
+			merged[j].zone &= ~params[i].zone;
 
-	has_type_aa = true;
-	type_aa = (struct hotkey_function_type_aa *) header;
+		for (j = 0; j < nr_merged; j++) {
+			if (merged[j].red == params[i].red &&
+			    merged[j].green == params[i].green &&
+			    merged[j].blue == params[i].blue)
+				break;
+		}
 
-	pr_info("Function bitmap for Communication Button: 0x%x\n",
-		type_aa->commun_func_bitmap);
-	commun_func_bitmap = type_aa->commun_func_bitmap;
+		if (j == nr_merged)
+			merged[nr_merged++] = params[i];
+		else
+			merged[j].zone |= params[i].zone;
+	}
 
-	if (type_aa->commun_func_bitmap & ACER_WMID3_GDS_WIRELESS)
-		interface->capability |= ACER_CAP_WIRELESS;
-	if (type_aa->commun_func_bitmap & ACER_WMID3_GDS_THREEG)
-		interface->capability |= ACER_CAP_THREEG;
-	if (type_aa->commun_func_bitmap & ACER_WMID3_GDS_BLUETOOTH)
-		interface->capability |= ACER_CAP_BLUETOOTH;
-	if (type_aa->commun_func_bitmap & ACER_WMID3_GDS_RFBTN)
-		commun_func_bitmap &= ~ACER_WMID3_GDS_RFBTN;
+	mutex_lock(&gkbbl_shadow.lock);
+	for (j = 0; j < nr_merged; j++) {
+		if (!merged[j].zone)
+			continue;
 
-	commun_fn_key_number = type_aa->commun_fn_key_number;
+		if (!READ_ONCE(gkbbl_write_through) &&
+		    gkbbl_static_shadow_match(&merged[j])) {
+			gkbbl_shadow.hits++;
+			continue;
+		}
+
+		gkbbl_shadow.misses++;
+		BUILD_BUG_ON(sizeof(merged[j]) != ACER_WMI_SET_GAMING_STATIC_LED_IN_LEN);
+		status = acer_wmi_exec(ACER_WMI_SET_GAMING_STATIC_LED, &merged[j],
+				       sizeof(merged[j]), NULL, NULL);
+		if (ACPI_FAILURE(status)) {
+			gkbbl_shadow.zones_valid &= ~merged[j].zone;
+			err = -EIO;
+			break;
+		}
+
+		gkbbl_static_shadow_update(&merged[j]);
+	}
+	mutex_unlock(&gkbbl_shadow.lock);
+
+	if (fw_status)
+		*fw_status = status;
+	return err;
 }
 
-static acpi_status __init WMID_set_capabilities(void)
+static ssize_t gkbbl_static_drv_write(struct file *file, const char __user *buf, size_t count, loff_t *offset)
 {
-	struct acpi_buffer out = {ACPI_ALLOCATE_BUFFER, NULL};
-	union acpi_object *obj;
-	acpi_status status;
-	u32 devices;
+	struct led_zone_set_param params[GAMING_KBBL_STATIC_MAX_ZONES];
+	size_t nr_params = count / GAMING_KBBL_STATIC_CONFIG_LEN;
+	size_t i;
+	int err;
 
-	status = wmi_query_block(WMID_GUID2, 0, &out);
-	if (ACPI_FAILURE(status))
-		return status;
+	if (!count || count % GAMING_KBBL_STATIC_CONFIG_LEN ||
+	    nr_params > GAMING_KBBL_STATIC_MAX_ZONES) {
+		pr_err("Invalid data given to gaming keyboard static backlight\n");
+		return -EINVAL;
+	}
 
-	obj = (union acpi_object *) out.pointer;
-	if (obj) {
-		if (obj->type == ACPI_TYPE_BUFFER &&
-			(obj->buffer.length == sizeof(u32) ||
-			obj->buffer.length == sizeof(u64))) {
-			devices = *((u32 *) obj->buffer.pointer);
-		} else if (obj->type == ACPI_TYPE_INTEGER) {
-			devices = (u32) obj->integer.value;
-		} else {
-			kfree(out.pointer);
-			return AE_ERROR;
+	if (copy_from_user(params, buf, count))
+		return -EFAULT;
+
+	for (i = 0; i < nr_params; i++) {
+		if (!params[i].zone) {
+			pr_err("Empty zone mask given to gaming keyboard static backlight\n");
+			return -EINVAL;
 		}
-	} else {
-		kfree(out.pointer);
-		return AE_ERROR;
 	}
 
-	pr_info("Function bitmap for Communication Device: 0x%x\n", devices);
-	if (devices & 0x07)
-		interface->capability |= ACER_CAP_WIRELESS;
-	if (devices & 0x40)
-		interface->capability |= ACER_CAP_THREEG;
-	if (devices & 0x10)
-		interface->capability |= ACER_CAP_BLUETOOTH;
+	trace_acer_gkbbl_submit("static", params, count, file->f_flags & O_NONBLOCK);
 
-	if (!(devices & 0x20))
-		max_brightness = 0x9;
+	if (file->f_flags & O_NONBLOCK)
+		err = gkbbl_async_submit(file->private_data, params, count, nr_params);
+	else
+		err = gkbbl_static_set_zones(params, nr_params, NULL);
+	if (err)
+		return err;
 
-	kfree(out.pointer);
-	return status;
+	return count;
 }
 
-static struct wmi_interface wmid_interface = {
-	.type = ACER_WMID,
-};
-
-static struct wmi_interface wmid_v2_interface = {
-	.type = ACER_WMID_v2,
-};
 
 /*
- * WMID Gaming interface
+ * Software animation engine for the static zones.
+ * A deferrable delayed work computes the per-zone colours of the selected
+ * effect with fixed point maths and pushes them through the static zone
+ * method. Positions within an effect period are in 1/GAMING_KBBL_ANIM_ONE
+ * steps, hues in 1/256 of a sextant. The work stops rescheduling itself
+ * when the effect has no period, since the frame can't change then.
  */
-
-static struct wmi_interface wmid_gaming_interface = {
-	.type = ACER_WMID_GAMING
+#define GAMING_KBBL_ANIM_ONE 1024
+#define GAMING_KBBL_ANIM_MAX_FPS 60
+#define GAMING_KBBL_ANIM_MAX_PERIOD_MS 600000
+#define GAMING_KBBL_ANIM_HUE_MAX (6 * 256)
+
+enum gkbbl_anim_effect {
+	GKBBL_ANIM_NONE,
+	GKBBL_ANIM_GRADIENT,
+	GKBBL_ANIM_BREATH,
+	GKBBL_ANIM_CROSSFADE,
+	GKBBL_ANIM_RAINBOW,
 };
 
-static acpi_status
-WMI_gaming_execute_u8_array(u32 method_id, u8 array[], size_t array_size, u32 *out)
-{
-	struct acpi_buffer input = { (acpi_size) array_size, (void *)(array) };
-	struct acpi_buffer result = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *obj;
-	u32 tmp = 0;
-	acpi_status status;
+static const char * const gkbbl_anim_effect_names[] = {
+	[GKBBL_ANIM_NONE] = "none",
+	[GKBBL_ANIM_GRADIENT] = "gradient",
+	[GKBBL_ANIM_BREATH] = "breath",
+	[GKBBL_ANIM_CROSSFADE] = "crossfade",
+	[GKBBL_ANIM_RAINBOW] = "rainbow",
+};
 
-	status = wmi_evaluate_method(WMID_GUID4, 0, method_id, &input, &result);
+struct gkbbl_anim_data {
+	struct mutex lock;
+	enum gkbbl_anim_effect effect;
+	u8 colors[2][3];
+	unsigned int period_ms;
+	unsigned int phase;
+	unsigned int fps;
+	unsigned int brightness;
+	u64 start_ns;
+	struct led_zone_set_param last[GAMING_KBBL_ZONES];
+	bool last_valid;
+	struct delayed_work work;
+};
 
-	if (ACPI_FAILURE(status))
-		return status;
+struct gkbbl_hsv {
+	u16 h;
+	u8 s;
+	u8 v;
+};
 
-	obj = (union acpi_object *) result.pointer;
-	if (obj) {
-		if (obj->type == ACPI_TYPE_BUFFER &&
-			(obj->buffer.length == sizeof(u32) ||
-			obj->buffer.length == sizeof(u64))) {
-			tmp = *((u32 *) obj->buffer.pointer);
-		} else if (obj->type == ACPI_TYPE_INTEGER) {
-			tmp = (u32) obj->integer.value;
-		}
-	}
+static void gkbbl_anim_work(struct work_struct *work);
+
+static struct gkbbl_anim_data gkbbl_anim = {
+	.lock = __MUTEX_INITIALIZER(gkbbl_anim.lock),
+	.colors = { { 0xff, 0x00, 0x00 }, { 0x00, 0x00, 0xff } },
+	.period_ms = 4000,
+	.phase = GAMING_KBBL_ANIM_ONE / GAMING_KBBL_ZONES,
+	.fps = 20,
+	.brightness = 100,
+	.work = __DELAYED_WORK_INITIALIZER(gkbbl_anim.work, gkbbl_anim_work,
+					   TIMER_DEFERRABLE),
+};
 
-	if (out)
-		*out = tmp;
+/* Triangle wave going 0 -> ONE -> 0 over one period */
+static unsigned int gkbbl_anim_triangle(unsigned int t)
+{
+	t %= GAMING_KBBL_ANIM_ONE;
 
-	kfree(result.pointer);
+	if (t < GAMING_KBBL_ANIM_ONE / 2)
+		return t * 2;
 
-	return status;
+	return (GAMING_KBBL_ANIM_ONE - t) * 2;
 }
 
+/* Smoothstep easing curve, 3x^2 - 2x^3 */
+static unsigned int gkbbl_anim_ease(unsigned int x)
+{
+	u64 v = (u64)x * x * (3 * GAMING_KBBL_ANIM_ONE - 2 * x);
+
+	return div_u64(v, GAMING_KBBL_ANIM_ONE * GAMING_KBBL_ANIM_ONE);
+}
 
-static acpi_status
-WMI_gaming_execute_u64(u32 method_id, u64 in, u64 *out)
+static void gkbbl_rgb_to_hsv(const u8 *rgb, struct gkbbl_hsv *hsv)
 {
-	struct acpi_buffer input = { (acpi_size) sizeof(u64), (void *)(&in) };
-	struct acpi_buffer result = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *obj;
-	u64 tmp = 0;
-	acpi_status status;
+	int r = rgb[0], g = rgb[1], b = rgb[2];
+	int max = max3(r, g, b);
+	int delta = max - min3(r, g, b);
+	int h;
+
+	hsv->v = max;
+	if (!delta) {
+		hsv->h = 0;
+		hsv->s = 0;
+		return;
+	}
 
-	status = wmi_evaluate_method(WMID_GUID4, 0, method_id, &input, &result);
+	hsv->s = delta * 255 / max;
 
-	if (ACPI_FAILURE(status))
-		return status;
-	obj = (union acpi_object *) result.pointer;
+	if (max == r)
+		h = (g - b) * 256 / delta;
+	else if (max == g)
+		h = 2 * 256 + (b - r) * 256 / delta;
+	else
+		h = 4 * 256 + (r - g) * 256 / delta;
 
-	if (obj) {
-		if (obj->type == ACPI_TYPE_BUFFER) {
-			if (obj->buffer.length == sizeof(u32))
-				tmp = *((u32 *) obj->buffer.pointer);
-			else if (obj->buffer.length == sizeof(u64))
-				tmp = *((u64 *) obj->buffer.pointer);
-		} else if (obj->type == ACPI_TYPE_INTEGER) {
-			tmp = (u64) obj->integer.value;
-		}
-	}
+	if (h < 0)
+		h += GAMING_KBBL_ANIM_HUE_MAX;
 
-	if (out)
-		*out = tmp;
+	hsv->h = h;
+}
 
-	kfree(result.pointer);
+static void gkbbl_hsv_to_rgb(const struct gkbbl_hsv *hsv, u8 *rgb)
+{
+	unsigned int region = (hsv->h / 256) % 6;
+	unsigned int rem = hsv->h % 256;
+	unsigned int v = hsv->v, s = hsv->s;
+	u8 p = v * (255 - s) / 255;
+	u8 q = v * (255 - s * rem / 255) / 255;
+	u8 t = v * (255 - s * (255 - rem) / 255) / 255;
+
+	switch (region) {
+	case 0:
+		rgb[0] = v;
+		rgb[1] = t;
+		rgb[2] = p;
+		break;
+	case 1:
+		rgb[0] = q;
+		rgb[1] = v;
+		rgb[2] = p;
+		break;
+	case 2:
+		rgb[0] = p;
+		rgb[1] = v;
+		rgb[2] = t;
+		break;
+	case 3:
+		rgb[0] = p;
+		rgb[1] = q;
+		rgb[2] = v;
+		break;
+	case 4:
+		rgb[0] = t;
+		rgb[1] = p;
+		rgb[2] = v;
+		break;
+	default:
+		rgb[0] = v;
+		rgb[1] = p;
+		rgb[2] = q;
+		break;
+	}
+}
 
-	return status;
+/* Interpolate between two colours in HSV space, along the shorter hue arc */
+static void gkbbl_anim_mix(const u8 *a, const u8 *b, unsigned int w, u8 *out)
+{
+	struct gkbbl_hsv ha, hb, hm;
+	int dh;
+
+	gkbbl_rgb_to_hsv(a, &ha);
+	gkbbl_rgb_to_hsv(b, &hb);
+
+	/* Greys have no hue of their own */
+	if (!ha.s)
+		ha.h = hb.h;
+	if (!hb.s)
+		hb.h = ha.h;
+
+	dh = hb.h - ha.h;
+	if (dh > GAMING_KBBL_ANIM_HUE_MAX / 2)
+		dh -= GAMING_KBBL_ANIM_HUE_MAX;
+	else if (dh < -GAMING_KBBL_ANIM_HUE_MAX / 2)
+		dh += GAMING_KBBL_ANIM_HUE_MAX;
+
+	hm.h = (ha.h + dh * (int)w / GAMING_KBBL_ANIM_ONE +
+		GAMING_KBBL_ANIM_HUE_MAX) % GAMING_KBBL_ANIM_HUE_MAX;
+	hm.s = ha.s + ((int)hb.s - ha.s) * (int)w / GAMING_KBBL_ANIM_ONE;
+	hm.v = ha.v + ((int)hb.v - ha.v) * (int)w / GAMING_KBBL_ANIM_ONE;
+
+	gkbbl_hsv_to_rgb(&hm, out);
 }
-#if RTLNX_VER_MIN(6, 14, 0)
-static int WMI_gaming_execute_u32_u64(u32 method_id, u32 in, u64 *out)
+
+static void gkbbl_anim_frame(const struct gkbbl_anim_data *anim, u64 now,
+			     struct led_zone_set_param *frame)
 {
-	struct acpi_buffer result = { ACPI_ALLOCATE_BUFFER, NULL };
-	struct acpi_buffer input = {
-		.length = sizeof(in),
-		.pointer = &in,
-	};
-	union acpi_object *obj;
-	acpi_status status;
-	int ret = 0;
+	struct gkbbl_hsv hsv;
+	unsigned int pos = 0, level, i, t;
+	u64 period_ns, rem;
+	u8 rgb[3];
+
+	if (anim->period_ms) {
+		period_ns = (u64)anim->period_ms * NSEC_PER_MSEC;
+		div64_u64_rem(now - anim->start_ns, period_ns, &rem);
+		pos = div64_u64(rem * GAMING_KBBL_ANIM_ONE, period_ns);
+	}
 
-	status = wmi_evaluate_method(WMID_GUID4, 0, method_id, &input, &result);
-	if (ACPI_FAILURE(status))
-		return -EIO;
+	for (i = 0; i < GAMING_KBBL_ZONES; i++) {
+		t = pos + i * anim->phase;
 
-	obj = result.pointer;
-	if (obj && out) {
-		switch (obj->type) {
-		case ACPI_TYPE_INTEGER:
-			*out = obj->integer.value;
+		switch (anim->effect) {
+		case GKBBL_ANIM_GRADIENT:
+			/* Zones are spread over half a period, so the gradient slides */
+			t = pos + i * GAMING_KBBL_ANIM_ONE / (2 * (GAMING_KBBL_ZONES - 1));
+			gkbbl_anim_mix(anim->colors[0], anim->colors[1],
+				       gkbbl_anim_ease(gkbbl_anim_triangle(t)), rgb);
 			break;
-		case ACPI_TYPE_BUFFER:
-			if (obj->buffer.length < sizeof(*out))
-				ret = -ENOMSG;
-			else
-				*out = get_unaligned_le64(obj->buffer.pointer);
-
+		case GKBBL_ANIM_BREATH:
+			level = gkbbl_anim_ease(gkbbl_anim_triangle(t));
+			rgb[0] = anim->colors[0][0] * level / GAMING_KBBL_ANIM_ONE;
+			rgb[1] = anim->colors[0][1] * level / GAMING_KBBL_ANIM_ONE;
+			rgb[2] = anim->colors[0][2] * level / GAMING_KBBL_ANIM_ONE;
+			break;
+		case GKBBL_ANIM_CROSSFADE:
+			gkbbl_anim_mix(anim->colors[0], anim->colors[1],
+				       gkbbl_anim_ease(gkbbl_anim_triangle(pos)), rgb);
+			break;
+		case GKBBL_ANIM_RAINBOW:
+			hsv.h = (t % GAMING_KBBL_ANIM_ONE) * GAMING_KBBL_ANIM_HUE_MAX /
+				GAMING_KBBL_ANIM_ONE;
+			hsv.s = 255;
+			hsv.v = 255;
+			gkbbl_hsv_to_rgb(&hsv, rgb);
 			break;
 		default:
-			ret = -ENOMSG;
+			memset(rgb, 0, sizeof(rgb));
 			break;
 		}
+
+		frame[i] = (struct led_zone_set_param) {
+			.zone = BIT(i),
+			.red = rgb[0],
+			.green = rgb[1],
+			.blue = rgb[2],
+		};
 	}
+}
 
-	kfree(obj);
+static void gkbbl_anim_work(struct work_struct *work)
+{
+	struct gkbbl_anim_data *anim = &gkbbl_anim;
+	struct led_zone_set_param frame[GAMING_KBBL_ZONES];
 
-	return ret;
+	mutex_lock(&anim->lock);
+	if (anim->effect == GKBBL_ANIM_NONE)
+		goto out;
+
+	gkbbl_anim_frame(anim, ktime_get_ns(), frame);
+	if (!anim->last_valid || memcmp(frame, anim->last, sizeof(frame))) {
+		if (!gkbbl_static_set_zones(frame, GAMING_KBBL_ZONES, NULL)) {
+			memcpy(anim->last, frame, sizeof(frame));
+			anim->last_valid = true;
+		}
+	}
+
+	if (anim->period_ms)
+		schedule_delayed_work(&anim->work,
+				      DIV_ROUND_UP(HZ, anim->fps));
+out:
+	mutex_unlock(&anim->lock);
 }
-#endif
 
-static acpi_status WMID_gaming_set_u64(u64 value, u32 cap)
+/* Must be called with the animation lock held after changing a parameter */
+static void gkbbl_anim_restart(struct gkbbl_anim_data *anim)
 {
-	u32 method_id = 0;
+	u8 config[GAMING_KBBL_CONFIG_LEN] = { 0 };
 
-	if (!(interface->capability & cap))
-		return AE_BAD_PARAMETER;
+	lockdep_assert_held(&anim->lock);
 
-	switch (cap) {
-	case ACER_CAP_TURBO_LED:
-		method_id = ACER_WMID_SET_GAMING_LED_METHODID;
-		break;
-	case ACER_CAP_TURBO_FAN:
-		method_id = ACER_WMID_SET_GAMING_FAN_BEHAVIOR;
-		break;
-	case ACER_CAP_TURBO_OC:
-		method_id = ACER_WMID_SET_GAMING_MISC_SETTING_METHODID;
-		break;
-	case ACER_CAP_GAMINGKB_STATIC:
-		method_id = ACER_WMID_SET_GAMING_STATIC_LED_METHODID;
-		return WMI_gaming_execute_u64(method_id, value, NULL);
-	default:
-		return AE_BAD_PARAMETER;
-	}
+	anim->last_valid = false;
+	if (anim->effect == GKBBL_ANIM_NONE)
+		return;
 
-	return WMI_gaming_execute_u64(method_id, value, NULL);
+	/* Switch the keyboard to static mode, the same way facer_rgb.py does */
+	config[2] = anim->brightness;
+	config[9] = 1;
+	gkbbl_apply_config(config, NULL);
+
+	mod_delayed_work(system_wq, &anim->work, 0);
 }
 
-static acpi_status WMID_gaming_set_u8_array(u8 array[], size_t array_size, u32 cap)
+static ssize_t gkbbl_anim_store_uint(const char *buf, size_t count,
+				     unsigned int *field,
+				     unsigned int min, unsigned int max)
 {
-	u32 method_id = 0;
+	unsigned int val;
+	int err;
 
-	switch (cap) {
-	case ACER_CAP_GAMINGKB:
-		if (array_size != GAMING_KBBL_CONFIG_LEN)
-			return AE_BAD_PARAMETER;
-		method_id = ACER_WMID_SET_GAMINGKBBL_METHODID;
-		break;
-	default:
-		return AE_ERROR;
-	}
-	return WMI_gaming_execute_u8_array(method_id, array, array_size, NULL);
+	err = kstrtouint(buf, 0, &val);
+	if (err)
+		return err;
+
+	if (val < min || val > max)
+		return -EINVAL;
+
+	mutex_lock(&gkbbl_anim.lock);
+	*field = val;
+	gkbbl_anim_restart(&gkbbl_anim);
+	mutex_unlock(&gkbbl_anim.lock);
+
+	return count;
 }
 
-static acpi_status WMID_gaming_get_u64(u64 *value, u32 cap)
+static ssize_t animation_effect_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
 {
-	acpi_status status;
-	u64 result;
-	u64 input;
-	u32 method_id;
+	return sysfs_emit(buf, "%s\n",
+			  gkbbl_anim_effect_names[READ_ONCE(gkbbl_anim.effect)]);
+}
 
-	if (!(interface->capability & cap))
-		return AE_BAD_PARAMETER;
+static ssize_t animation_effect_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	int effect;
 
-	switch (cap) {
-	case ACER_CAP_TURBO_LED:
-		method_id = ACER_WMID_GET_GAMING_LED_METHODID;
-		input = 0x1;
-		break;
-	default:
-		return AE_BAD_PARAMETER;
-	}
-	status = WMI_gaming_execute_u64(method_id, input, &result);
-	if (ACPI_SUCCESS(status))
-		*value = (u64) result;
+	effect = sysfs_match_string(gkbbl_anim_effect_names, buf);
+	if (effect < 0)
+		return effect;
 
-	return status;
+	mutex_lock(&gkbbl_anim.lock);
+	gkbbl_anim.effect = effect;
+	gkbbl_anim.start_ns = ktime_get_ns();
+	gkbbl_anim_restart(&gkbbl_anim);
+	mutex_unlock(&gkbbl_anim.lock);
+
+	return count;
 }
+static DEVICE_ATTR_RW(animation_effect);
 
-static void WMID_gaming_set_fan_mode(u8 fan_mode)
+static ssize_t animation_colors_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
 {
-	/* fan_mode = 1 is used for auto, fan_mode = 2 used for turbo*/
-	u64 gpu_fan_config1 = 0, gpu_fan_config2 = 0;
-	int i;
+	u8 colors[2][3];
 
-	if (quirks->cpu_fans > 0)
-		gpu_fan_config2 |= 1;
-	for (i = 0; i < (quirks->cpu_fans + quirks->gpu_fans); ++i)
-		gpu_fan_config2 |= 1 << (i + 1);
-	for (i = 0; i < quirks->gpu_fans; ++i)
-		gpu_fan_config2 |= 1 << (i + 3);
-	if (quirks->cpu_fans > 0)
-		gpu_fan_config1 |= fan_mode;
-	for (i = 0; i < (quirks->cpu_fans + quirks->gpu_fans); ++i)
-		gpu_fan_config1 |= fan_mode << (2 * i + 2);
-	for (i = 0; i < quirks->gpu_fans; ++i)
-		gpu_fan_config1 |= fan_mode << (2 * i + 6);
-	WMID_gaming_set_u64(gpu_fan_config2 | gpu_fan_config1 << 16, ACER_CAP_TURBO_FAN);
+	mutex_lock(&gkbbl_anim.lock);
+	memcpy(colors, gkbbl_anim.colors, sizeof(colors));
+	mutex_unlock(&gkbbl_anim.lock);
+
+	return sysfs_emit(buf, "%02x%02x%02x %02x%02x%02x\n",
+			  colors[0][0], colors[0][1], colors[0][2],
+			  colors[1][0], colors[1][1], colors[1][2]);
 }
- 
-static int WMID_gaming_set_misc_setting(enum acer_wmi_gaming_misc_setting setting, u8 value)
+
+static ssize_t animation_colors_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
 {
-	acpi_status status;
-	u64 input = 0;
-	u64 result;
+	unsigned int first, second;
 
-	input |= FIELD_PREP(ACER_GAMING_MISC_SETTING_INDEX_MASK, setting);
-	input |= FIELD_PREP(ACER_GAMING_MISC_SETTING_VALUE_MASK, value);
+	if (sscanf(buf, "%6x %6x", &first, &second) != 2)
+		return -EINVAL;
 
-	status = WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_MISC_SETTING_METHODID, input, &result);
-	if (ACPI_FAILURE(status))
-		return -EIO;
+	mutex_lock(&gkbbl_anim.lock);
+	gkbbl_anim.colors[0][0] = first >> 16;
+	gkbbl_anim.colors[0][1] = first >> 8;
+	gkbbl_anim.colors[0][2] = first;
+	gkbbl_anim.colors[1][0] = second >> 16;
+	gkbbl_anim.colors[1][1] = second >> 8;
+	gkbbl_anim.colors[1][2] = second;
+	gkbbl_anim_restart(&gkbbl_anim);
+	mutex_unlock(&gkbbl_anim.lock);
 
-	/* The return status must be zero for the operation to have succeeded */
-	if (FIELD_GET(ACER_GAMING_MISC_SETTING_STATUS_MASK, result))
-		return -EIO;
+	return count;
+}
+static DEVICE_ATTR_RW(animation_colors);
 
-	return 0;
+static ssize_t animation_period_ms_show(struct device *dev,
+					struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(gkbbl_anim.period_ms));
 }
 
-#if RTLNX_VER_MIN(6, 14, 0)
-static int WMID_gaming_get_misc_setting(enum acer_wmi_gaming_misc_setting setting, u8 *value)
+static ssize_t animation_period_ms_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
 {
-	u64 input = 0;
-	u64 result;
-	int ret;
+	return gkbbl_anim_store_uint(buf, count, &gkbbl_anim.period_ms,
+				     0, GAMING_KBBL_ANIM_MAX_PERIOD_MS);
+}
+static DEVICE_ATTR_RW(animation_period_ms);
 
-	input |= FIELD_PREP(ACER_GAMING_MISC_SETTING_INDEX_MASK, setting);
+static ssize_t animation_phase_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(gkbbl_anim.phase));
+}
 
-	ret = WMI_gaming_execute_u32_u64(ACER_WMID_GET_GAMING_MISC_SETTING_METHODID, input,
-					 &result);
-	if (ret < 0)
-		return ret;
+static ssize_t animation_phase_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	return gkbbl_anim_store_uint(buf, count, &gkbbl_anim.phase,
+				     0, GAMING_KBBL_ANIM_ONE - 1);
+}
+static DEVICE_ATTR_RW(animation_phase);
 
-	/* The return status must be zero for the operation to have succeeded */
-	if (FIELD_GET(ACER_GAMING_MISC_SETTING_STATUS_MASK, result))
-		return -EIO;
+static ssize_t animation_fps_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(gkbbl_anim.fps));
+}
 
-	*value = FIELD_GET(ACER_GAMING_MISC_SETTING_VALUE_MASK, result);
+static ssize_t animation_fps_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	return gkbbl_anim_store_uint(buf, count, &gkbbl_anim.fps,
+				     1, GAMING_KBBL_ANIM_MAX_FPS);
+}
+static DEVICE_ATTR_RW(animation_fps);
 
-	return 0;
+static ssize_t animation_brightness_show(struct device *dev,
+					 struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(gkbbl_anim.brightness));
 }
-#endif
+
+static ssize_t animation_brightness_store(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	return gkbbl_anim_store_uint(buf, count, &gkbbl_anim.brightness,
+				     0, 100);
+}
+static DEVICE_ATTR_RW(animation_brightness);
+
+static struct attribute *gkbbl_static_dev_attrs[] = {
+	&dev_attr_animation_effect.attr,
+	&dev_attr_animation_colors.attr,
+	&dev_attr_animation_period_ms.attr,
+	&dev_attr_animation_phase.attr,
+	&dev_attr_animation_fps.attr,
+	&dev_attr_animation_brightness.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(gkbbl_static_dev);
+
 /*
- * Generic Device (interface-independent)
+ * Timestamped frame queue for the static zones.
+ * User space queues batches of frames with a CLOCK_MONOTONIC deadline
+ * through GAMING_KBBL_IOC_QUEUE_FRAMES. An hrtimer fires at the deadline
+ * of the oldest frame and kicks a work item that applies it, since the
+ * firmware call may sleep. Frames more than gkbbl_frame_late_us past
+ * their deadline are dropped instead of being applied.
  */
+#define GAMING_KBBL_FRAME_QUEUE_LEN 64
+
+struct gkbbl_frame_queue {
+	struct mutex submit_lock;
+	DECLARE_KFIFO(fifo, struct gkbbl_timed_frame, GAMING_KBBL_FRAME_QUEUE_LEN);
+	u64 last_deadline_ns;
+	struct hrtimer timer;
+	struct work_struct work;
+	bool stopping;
+
+	/* Statistics, exported through debugfs */
+	u64 applied;		/* Only updated by the work */
+	atomic64_t late;	/* Updated by the work and by submitters */
+};
 
-static acpi_status get_u32(u32 *value, u32 cap)
+static struct gkbbl_frame_queue gkbbl_frames = {
+	.submit_lock = __MUTEX_INITIALIZER(gkbbl_frames.submit_lock),
+};
+
+static bool gkbbl_frame_is_late(const struct gkbbl_timed_frame *frame, u64 now)
 {
-	acpi_status status = AE_ERROR;
+	return now > frame->deadline_ns &&
+	       now - frame->deadline_ns > (u64)READ_ONCE(gkbbl_frame_late_us) * NSEC_PER_USEC;
+}
 
-	switch (interface->type) {
-	case ACER_AMW0:
-		status = AMW0_get_u32(value, cap);
-		break;
-	case ACER_AMW0_V2:
-		if (cap == ACER_CAP_MAILLED) {
-			status = AMW0_get_u32(value, cap);
-			break;
+static void gkbbl_frames_work(struct work_struct *work)
+{
+	struct gkbbl_frame_queue *q = &gkbbl_frames;
+	struct led_zone_set_param zones[GAMING_KBBL_ZONES];
+	struct gkbbl_timed_frame frame;
+	size_t i, nr_zones;
+	u64 now;
+
+	while (kfifo_peek(&q->fifo, &frame)) {
+		now = ktime_get_ns();
+		if (frame.deadline_ns > now) {
+			if (!READ_ONCE(q->stopping))
+				hrtimer_start(&q->timer, ns_to_ktime(frame.deadline_ns),
+					      HRTIMER_MODE_ABS);
+			return;
 		}
-		fallthrough;
-	case ACER_WMID:
-		status = WMID_get_u32(value, cap);
-		break;
-	case ACER_WMID_v2:
-		if (cap & (ACER_CAP_WIRELESS |
-			   ACER_CAP_BLUETOOTH |
-			   ACER_CAP_THREEG))
-			status = wmid_v2_get_u32(value, cap);
-		else if (wmi_has_guid(WMID_GUID2))
-			status = WMID_get_u32(value, cap);
-		break;
+
+		kfifo_skip(&q->fifo);
+
+		if (gkbbl_frame_is_late(&frame, now)) {
+			atomic64_inc(&q->late);
+			continue;
+		}
+
+		nr_zones = 0;
+		for (i = 0; i < GAMING_KBBL_ZONES; i++) {
+			if (frame.zones[i].zone)
+				zones[nr_zones++] = frame.zones[i];
+		}
+
+		if (nr_zones && !gkbbl_static_set_zones(zones, nr_zones, NULL))
+			q->applied++;
 	}
+}
 
-	return status;
+static enum hrtimer_restart gkbbl_frames_timer_fn(struct hrtimer *timer)
+{
+	queue_work(system_highpri_wq, &gkbbl_frames.work);
+	return HRTIMER_NORESTART;
 }
 
-static acpi_status set_u32(u32 value, u32 cap)
+static long gkbbl_frames_submit(void __user *argp)
 {
-	acpi_status status;
+	struct gkbbl_frame_queue *q = &gkbbl_frames;
+	struct gkbbl_timed_frame *frames;
+	struct gkbbl_frame_batch batch;
+	unsigned int i, first = 0;
+	u64 now, last;
+	long ret;
 
-	if (interface->capability & cap) {
-		switch (interface->type) {
-		case ACER_AMW0:
-			return AMW0_set_u32(value, cap);
-		case ACER_AMW0_V2:
-			if (cap == ACER_CAP_MAILLED)
-				return AMW0_set_u32(value, cap);
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
 
-			/*
-			 * On some models, some WMID methods don't toggle
-			 * properly. For those cases, we want to run the AMW0
-			 * method afterwards to be certain we've really toggled
-			 * the device state.
-			 */
-			if (cap == ACER_CAP_WIRELESS ||
-				cap == ACER_CAP_BLUETOOTH) {
-				status = WMID_set_u32(value, cap);
-				if (ACPI_FAILURE(status))
-					return status;
+	if (batch.reserved)
+		return -EINVAL;
 
-				return AMW0_set_u32(value, cap);
-			}
-			fallthrough;
-		case ACER_WMID:
-			return WMID_set_u32(value, cap);
-		case ACER_WMID_v2:
-			if (cap & (ACER_CAP_WIRELESS |
-				   ACER_CAP_BLUETOOTH |
-				   ACER_CAP_THREEG))
-				return wmid_v2_set_u32(value, cap);
-			else if (wmi_has_guid(WMID_GUID2))
-				return WMID_set_u32(value, cap);
-			fallthrough;
-		default:
-			return AE_BAD_PARAMETER;
-		}
+	if (!batch.count)
+		return 0;
+
+	if (batch.count > GAMING_KBBL_FRAME_QUEUE_LEN)
+		return -EINVAL;
+
+	frames = kmalloc_array(batch.count, sizeof(*frames), GFP_KERNEL);
+	if (!frames)
+		return -ENOMEM;
+
+	if (copy_from_user(frames, u64_to_user_ptr(batch.frames),
+			   batch.count * sizeof(*frames))) {
+		kfree(frames);
+		return -EFAULT;
 	}
-	return AE_BAD_PARAMETER;
-}
 
-static acpi_status set_u8_array(u8 array[], size_t array_size, u32 cap)
-{
-	acpi_status status;
+	mutex_lock(&q->submit_lock);
 
-	if (interface->capability & cap) {
-		switch (interface->type) {
-		default:
-			return AE_BAD_PARAMETER;
-		}
-	} else if (gaming_interface->capability & cap) {
-		switch (gaming_interface->type) {
-		case ACER_WMID_GAMING:
-			status = WMID_gaming_set_u8_array(array, array_size, cap);
-			if (ACPI_FAILURE(status))
-				return status;
-			fallthrough;
-		default:
-			return AE_BAD_PARAMETER;
+	/* Frames are played in order, so deadlines must not go backwards */
+	last = kfifo_is_empty(&q->fifo) ? 0 : q->last_deadline_ns;
+	for (i = 0; i < batch.count; i++) {
+		if (frames[i].deadline_ns < last) {
+			ret = -EINVAL;
+			goto out;
 		}
+		last = frames[i].deadline_ns;
+	}
+
+	/* Frames already late are dropped right away */
+	now = ktime_get_ns();
+	while (first < batch.count && gkbbl_frame_is_late(&frames[first], now))
+		first++;
+	atomic64_add(first, &q->late);
+
+	if (kfifo_avail(&q->fifo) < batch.count - first) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	if (first < batch.count) {
+		kfifo_in(&q->fifo, &frames[first], batch.count - first);
+		q->last_deadline_ns = last;
+		queue_work(system_highpri_wq, &q->work);
 	}
-	return AE_BAD_PARAMETER;
+
+	ret = batch.count - first;
+out:
+	mutex_unlock(&q->submit_lock);
+	kfree(frames);
+	return ret;
 }
 
-static void __init acer_commandline_init(void)
+static void __init gkbbl_frames_init(void)
 {
-	/*
-	 * These will all fail silently if the value given is invalid, or the
-	 * capability isn't available on the given interface
-	 */
-	if (mailled >= 0)
-		set_u32(mailled, ACER_CAP_MAILLED);
-	if (!has_type_aa && threeg >= 0)
-		set_u32(threeg, ACER_CAP_THREEG);
-	if (brightness >= 0)
-		set_u32(brightness, ACER_CAP_BRIGHTNESS);
+	struct gkbbl_frame_queue *q = &gkbbl_frames;
+
+	INIT_KFIFO(q->fifo);
+	INIT_WORK(&q->work, gkbbl_frames_work);
+#if RTLNX_VER_MIN(6, 13, 0)
+	hrtimer_setup(&q->timer, gkbbl_frames_timer_fn, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_ABS);
+#else
+	hrtimer_init(&q->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	q->timer.function = gkbbl_frames_timer_fn;
+#endif
 }
 
-/*
- * LED device (Mail LED only, no other LEDs known yet)
- */
-static void mail_led_set(struct led_classdev *led_cdev,
-enum led_brightness value)
+static void __exit gkbbl_frames_exit(void)
 {
-	set_u32(value, ACER_CAP_MAILLED);
-}
+	struct gkbbl_frame_queue *q = &gkbbl_frames;
 
-static struct led_classdev mail_led = {
-	.name = "acer-wmi::mail",
-	.brightness_set = mail_led_set,
-};
+	WRITE_ONCE(q->stopping, true);
+	hrtimer_cancel(&q->timer);
+	cancel_work_sync(&q->work);
+	hrtimer_cancel(&q->timer);
+}
 
-static int acer_led_init(struct device *dev)
+static int gkbbl_frames_depth_get(void *data, u64 *val)
 {
-	return led_classdev_register(dev, &mail_led);
+	*val = kfifo_len(&gkbbl_frames.fifo);
+	return 0;
 }
+DEFINE_DEBUGFS_ATTRIBUTE(gkbbl_frames_depth_fops, gkbbl_frames_depth_get,
+			 NULL, "%llu\n");
 
-static void acer_led_exit(void)
+static int gkbbl_frames_late_get(void *data, u64 *val)
 {
-	set_u32(LED_OFF, ACER_CAP_MAILLED);
-	led_classdev_unregister(&mail_led);
+	*val = atomic64_read(&gkbbl_frames.late);
+	return 0;
 }
+DEFINE_DEBUGFS_ATTRIBUTE(gkbbl_frames_late_fops, gkbbl_frames_late_get,
+			 NULL, "%llu\n");
 
-/*
- * Keyboard RGB backlight character device handler.
- * On systems supporting Acer gaming functions, a char device
- * will be exposed to communicate with user space
- * for keyboard RGB backlight configurations.
- */
-
-static ssize_t gkbbl_drv_write(struct file *file,
-		const char __user *buf, size_t count, loff_t *offset)
+static long gkbbl_static_drv_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-	u8 config_buf[GAMING_KBBL_CONFIG_LEN];
-	unsigned long err;
-
-	if (count != GAMING_KBBL_CONFIG_LEN) {
-		pr_err("Invalid data given to gaming keyboard backlight");
-		return 0;
+	switch (cmd) {
+	case GAMING_KBBL_IOC_QUEUE_FRAMES:
+		return gkbbl_frames_submit((void __user *)arg);
+	default:
+		return -ENOTTY;
 	}
-	err = copy_from_user(config_buf, buf, GAMING_KBBL_CONFIG_LEN);
-	if (err < 0)
-		pr_err("Copying data from userspace failed with code: %lu\n", err);
-
-	set_u8_array(config_buf, GAMING_KBBL_CONFIG_LEN, ACER_CAP_GAMINGKB);
-	return count;
 }
 
+static int gkbbl_static_drv_open(struct inode *inode, struct file *file)
+{
+	return gkbbl_file_open(file, true);
+}
 
-static const struct file_operations gkbbl_dev_fops = {
+static const struct file_operations gkbbl_static_dev_fops = {
 		.owner      = THIS_MODULE,
-		.write       = gkbbl_drv_write
+		.open        = gkbbl_static_drv_open,
+		.release     = gkbbl_drv_release,
+		.read        = gkbbl_drv_read,
+		.write       = gkbbl_static_drv_write,
+		.poll        = gkbbl_drv_poll,
+		.fsync       = gkbbl_drv_fsync,
+		.unlocked_ioctl = gkbbl_static_drv_ioctl,
+		.compat_ioctl = compat_ptr_ioctl,
 };
 
-struct gkbbl_device_data {
-	struct cdev cdev;
-};
+static void __init gaming_kbbl_create_debugfs(struct dentry *root)
+{
+	struct gkbbl_coalesce_data *data = &gkbbl_coalesce_data;
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("gkbbl", root);
+
+	debugfs_create_u64("submitted", S_IRUGO, dir, &data->submitted);
+	debugfs_create_u64("applied", S_IRUGO, dir, &data->applied);
+	debugfs_create_u64("dropped", S_IRUGO, dir, &data->dropped);
+	debugfs_create_u64("cache_hits", S_IRUGO, dir, &gkbbl_shadow.hits);
+	debugfs_create_u64("cache_misses", S_IRUGO, dir, &gkbbl_shadow.misses);
+	debugfs_create_u64("frames_applied", S_IRUGO, dir, &gkbbl_frames.applied);
+	debugfs_create_file_unsafe("frames_late", S_IRUGO, dir, NULL,
+				   &gkbbl_frames_late_fops);
+	debugfs_create_file_unsafe("frames_queued", S_IRUGO, dir, NULL,
+				   &gkbbl_frames_depth_fops);
+}
 
-static struct class *gkbbl_dev_class;
-static struct gkbbl_device_data gkbbl_dev_data;
+static struct class *gkbbl_static_dev_class;
+static struct gkbbl_device_data gkbbl_static_dev_data;
 
-static int gkbbl_dev_uevent(
+static int gkbbl_static_dev_uevent(
 #if RTLNX_VER_MIN(6, 2, 0)
 const
 #endif
@@ -2381,172 +5595,293 @@ struct device *dev, struct kobj_uevent_env *env)
 	return 0;
 }
 
-static int __init gaming_kbbl_cdev_init(void)
+static int __init gaming_kbbl_static_cdev_init(void)
 {
 	dev_t dev;
 	int err;
 
-	err = alloc_chrdev_region(&dev, 0, 1, GAMING_KBBL_CHR);
+	err = alloc_chrdev_region(&dev, 0, 1, GAMING_KBBL_STATIC_CHR);
 	if (err < 0) {
-		pr_err("Char drive registering for gaming keyboard backlight failed: %d\n", err);
+		pr_err("Char drive registering for gaming keyboard static backlight failed: %d\n", err);
 		return err;
 	}
 
-	gkbbl_dynamic_dev = dev;
+	gkbbl_static_dev = dev;
+
+	gkbbl_frames_init();
 
 	#if RTLNX_VER_MIN(6, 4, 0)
-		gkbbl_dev_class = class_create(GAMING_KBBL_CHR);
+		gkbbl_static_dev_class = class_create(GAMING_KBBL_STATIC_CHR);
 	#else
-		gkbbl_dev_class = class_create(THIS_MODULE, GAMING_KBBL_CHR);
+		gkbbl_static_dev_class = class_create(THIS_MODULE, GAMING_KBBL_STATIC_CHR);
 	#endif
 
-	gkbbl_dev_class->dev_uevent = gkbbl_dev_uevent;
+	gkbbl_static_dev_class->dev_uevent = gkbbl_static_dev_uevent;
 
-	cdev_init(&gkbbl_dev_data.cdev, &gkbbl_dev_fops);
-	gkbbl_dev_data.cdev.owner = THIS_MODULE;
+	cdev_init(&gkbbl_static_dev_data.cdev, &gkbbl_static_dev_fops);
+	gkbbl_static_dev_data.cdev.owner = THIS_MODULE;
 
-	cdev_add(&gkbbl_dev_data.cdev, gkbbl_dynamic_dev, 1);
+	cdev_add(&gkbbl_static_dev_data.cdev, gkbbl_static_dev, 1);
 
-	device_create(gkbbl_dev_class, NULL, gkbbl_dynamic_dev, NULL, "%s-%d",
-			   GAMING_KBBL_CHR,
-			   GAMING_KBBL_MINOR);
+	device_create_with_groups(gkbbl_static_dev_class, NULL, gkbbl_static_dev, NULL,
+				  gkbbl_static_dev_groups, "%s-%d",
+				  GAMING_KBBL_STATIC_CHR,
+				  GAMING_KBBL_STATIC_MINOR);
 
 	return 0;
 }
 
-static void __exit gaming_kbbl_cdev_exit(void)
+static int __init gaming_kbbl_poll_and_enable_zones(void)
 {
-	device_destroy(gkbbl_dev_class, gkbbl_dynamic_dev);
+	u64 input = 0;
+	/*
+	 * Querying GetGamingSysInfo appears to be required to enable Nitro AN515-57
+	 * and possibly other Acer (Predator/Nitro) 4 zone LED keyboards.
+	 * Both are queued as lighting commands, which keeps them in order and
+	 * doesn't hold up loading.
+	 */
+	acer_cmd_queue(ACER_CMD_LIGHTING, WMID_GUID4, ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+		       &input, sizeof(input));
+	/* Turn on all 4 zones */
+	input = 8L | (15UL<<40);
+	acer_cmd_queue(ACER_CMD_LIGHTING, WMID_GUID4, ACER_WMID_SET_GAMING_LED_METHODID,
+		       &input, sizeof(input));
+	return 0;
+}
 
-	class_unregister(gkbbl_dev_class);
-	class_destroy(gkbbl_dev_class);
-	cdev_del(&gkbbl_dev_data.cdev);
+static void __exit gaming_kbbl_static_cdev_exit(void)
+{
+	device_destroy(gkbbl_static_dev_class, gkbbl_static_dev);
+	cancel_delayed_work_sync(&gkbbl_anim.work);
+	gkbbl_frames_exit();
 
-	unregister_chrdev_region(gkbbl_dynamic_dev, 1);
-}
+	class_unregister(gkbbl_static_dev_class);
+	class_destroy(gkbbl_static_dev_class);
+	cdev_del(&gkbbl_static_dev_data.cdev);
 
+	unregister_chrdev_region(gkbbl_static_dev, 1);
+}
 
 /*
- * Keyboard RGB backlight character device handler.
- * On systems supporting Acer gaming functions, a char device
- * will be exposed to communicate with user space
- * for keyboard RGB backlight configurations.
- * Similar to above, but for handling static coloring
+ * LED class devices for the keyboard backlight
+ * Each zone is a multicolor LED driving its static colour, kbd_backlight
+ * sets the brightness of the whole keyboard. Zone colours only show in
+ * static mode, so setting one switches the keyboard to it.
  */
+#if IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR)
 
+#define GAMING_KBBL_BREATH_MODE 1
+#define GAMING_KBBL_BLINK_STEP_MS 250
 
-struct led_zone_set_param {
-		u8 zone;
-		u8 red;
-		u8 green;
-		u8 blue;
-} __packed;
+struct gkbbl_zone_led {
+	struct led_classdev_mc mc;
+	struct mc_subled subleds[3];
+	u8 zone;
+};
 
-static ssize_t gkbbl_static_drv_write(struct file *file, const char __user *buf, size_t count, loff_t *offset)
+static struct gkbbl_zone_led gkbbl_zone_leds[GAMING_KBBL_ZONES];
+
+/* Effect config active before kbd_backlight started blinking */
+static u8 gkbbl_blink_saved[GAMING_KBBL_CONFIG_LEN];
+static bool gkbbl_blinking;
+static DEFINE_MUTEX(gkbbl_led_lock);
+
+static u8 gkbbl_current_brightness(void)
 {
-	u8 config_buf[4]={0,0,0,0};
-	unsigned long err;
-	struct led_zone_set_param set_params;
-	struct acpi_buffer set_input;
-	err = copy_from_user(config_buf, buf, GAMING_KBBL_STATIC_CONFIG_LEN);
-	set_params = (struct led_zone_set_param) {
-		.zone = config_buf[0],
-		.red = config_buf[1],
-		.green = config_buf[2],
-		.blue = config_buf[3],
-	};
-	set_input = (struct acpi_buffer) {
-		sizeof(set_params),
-		&set_params
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+
+	if (!gkbbl_shadow_get_config(config))
+		return GAMING_KBBL_MAX_BRIGHTNESS;
+
+	return config[2];
+}
+
+static int gkbbl_static_config(u8 brightness)
+{
+	struct gkbbl_effect effect = {
+		.version = GAMING_KBBL_API_VERSION,
+		.brightness = brightness,
 	};
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+	int err;
+
+	err = gkbbl_effect_to_config(&effect, config);
+	if (err)
+		return err;
+
+	return gkbbl_apply_config(config, NULL);
+}
+
+/* Zone colours only show in static mode, switch to it unless already there */
+static int gkbbl_static_mode_ensure(void)
+{
+	u8 config[GAMING_KBBL_CONFIG_LEN];
 
-	if (count != GAMING_KBBL_STATIC_CONFIG_LEN) {
-		pr_err("Invalid data given to gaming keyboard static backlight");
+	if (gkbbl_shadow_get_config(config) && config[0] == 0)
 		return 0;
-	}
 
-	if (err < 0)
-		pr_err("Copying data from userspace failed with code: %lu\n", err);
+	return gkbbl_static_config(gkbbl_current_brightness());
+}
 
-	wmi_evaluate_method( WMID_GUID4, 0, ACER_WMID_SET_GAMING_STATIC_LED_METHODID, &set_input, NULL);
-	return count;
+static int gkbbl_zone_led_set(struct led_classdev *cdev, enum led_brightness brightness)
+{
+	struct led_classdev_mc *mc = lcdev_to_mccdev(cdev);
+	struct gkbbl_zone_led *led = container_of(mc, struct gkbbl_zone_led, mc);
+	struct led_zone_set_param param;
+	int err;
+
+	led_mc_calc_color_components(mc, brightness);
+
+	param.zone = BIT(led->zone);
+	param.red = led->subleds[0].brightness;
+	param.green = led->subleds[1].brightness;
+	param.blue = led->subleds[2].brightness;
+
+	mutex_lock(&gkbbl_led_lock);
+	err = gkbbl_static_set_zones(&param, 1, NULL);
+	if (!err && !gkbbl_blinking)
+		err = gkbbl_static_mode_ensure();
+	mutex_unlock(&gkbbl_led_lock);
+
+	return err;
 }
 
+static int gkbbl_kbd_led_set(struct led_classdev *cdev, enum led_brightness brightness)
+{
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+	int err;
 
-static const struct file_operations gkbbl_static_dev_fops = {
-		.owner      = THIS_MODULE,
-		.write       = gkbbl_static_drv_write
-};
+	mutex_lock(&gkbbl_led_lock);
+	if (gkbbl_blinking) {
+		memcpy(config, gkbbl_blink_saved, GAMING_KBBL_CONFIG_LEN);
+		gkbbl_blinking = false;
+	} else if (!gkbbl_shadow_get_config(config)) {
+		/* Static mode */
+		memset(config, 0, GAMING_KBBL_CONFIG_LEN);
+	}
 
-static struct class *gkbbl_static_dev_class;
-static struct gkbbl_device_data gkbbl_static_dev_data;
+	config[2] = brightness;
+	config[9] = 1;
+	err = gkbbl_apply_config(config, NULL);
+	mutex_unlock(&gkbbl_led_lock);
 
-static int gkbbl_static_dev_uevent(
-#if RTLNX_VER_MIN(6, 2, 0)
-const
-#endif
-struct device *dev, struct kobj_uevent_env *env)
-{
-	add_uevent_var(env, "DEVMODE=%#o", 0666);
-	return 0;
+	return err;
 }
 
-static int __init gaming_kbbl_static_cdev_init(void)
+/*
+ * Blinking is offloaded to the breath effect in the colour of the first
+ * zone. The firmware speed steps are coarse, the resulting period is
+ * reported back through the delays.
+ */
+static int gkbbl_kbd_led_blink_set(struct led_classdev *cdev,
+				   unsigned long *delay_on, unsigned long *delay_off)
 {
-	dev_t dev;
+	struct gkbbl_zone_led *zone = &gkbbl_zone_leds[0];
+	struct gkbbl_effect effect = {
+		.version = GAMING_KBBL_API_VERSION,
+		.mode = GAMING_KBBL_BREATH_MODE,
+		.direction = 1,
+		.red = zone->subleds[0].intensity,
+		.green = zone->subleds[1].intensity,
+		.blue = zone->subleds[2].intensity,
+	};
+	u8 config[GAMING_KBBL_CONFIG_LEN];
+	unsigned long period;
 	int err;
 
-	err = alloc_chrdev_region(&dev, 0, 1, GAMING_KBBL_STATIC_CHR);
-	if (err < 0) {
-		pr_err("Char drive registering for gaming keyboard static backlight failed: %d\n", err);
-		return err;
+	if (!*delay_on && !*delay_off) {
+		*delay_on = 500;
+		*delay_off = 500;
 	}
 
-	gkbbl_static_dev = dev;
+	/* Speed 9 is the fastest, every step down adds about 250ms */
+	period = *delay_on + *delay_off;
+	effect.speed = clamp_t(long, 10 - DIV_ROUND_CLOSEST(period, GAMING_KBBL_BLINK_STEP_MS),
+			       1, 9);
+	*delay_on = (10 - effect.speed) * GAMING_KBBL_BLINK_STEP_MS / 2;
+	*delay_off = *delay_on;
+
+	mutex_lock(&gkbbl_led_lock);
+	effect.brightness = cdev->brightness ? cdev->brightness : cdev->max_brightness;
+	if (!gkbbl_blinking && !gkbbl_shadow_get_config(gkbbl_blink_saved)) {
+		memset(gkbbl_blink_saved, 0, GAMING_KBBL_CONFIG_LEN);
+		gkbbl_blink_saved[2] = effect.brightness;
+		gkbbl_blink_saved[9] = 1;
+	}
 
-	#if RTLNX_VER_MIN(6, 4, 0)
-		gkbbl_static_dev_class = class_create(GAMING_KBBL_STATIC_CHR);
-	#else
-		gkbbl_static_dev_class = class_create(THIS_MODULE, GAMING_KBBL_STATIC_CHR);
-	#endif
+	err = gkbbl_effect_to_config(&effect, config);
+	if (!err)
+		err = gkbbl_apply_config(config, NULL);
+	if (!err)
+		gkbbl_blinking = true;
+	mutex_unlock(&gkbbl_led_lock);
 
-	gkbbl_static_dev_class->dev_uevent = gkbbl_static_dev_uevent;
+	return err;
+}
 
-	cdev_init(&gkbbl_static_dev_data.cdev, &gkbbl_static_dev_fops);
-	gkbbl_static_dev_data.cdev.owner = THIS_MODULE;
+/*
+ * All keyboard LEDs keep their state when unregistered, so unloading the
+ * module leaves the keyboard lit as it was.
+ */
+static struct led_classdev gkbbl_kbd_led = {
+	.name = "acer-wmi::kbd_backlight",
+	.max_brightness = GAMING_KBBL_MAX_BRIGHTNESS,
+	.flags = LED_RETAIN_AT_SHUTDOWN,
+	.brightness_set_blocking = gkbbl_kbd_led_set,
+	.blink_set = gkbbl_kbd_led_blink_set,
+};
 
-	cdev_add(&gkbbl_static_dev_data.cdev, gkbbl_static_dev, 1);
+static int gkbbl_leds_init(struct device *dev)
+{
+	static const int color_ids[] = { LED_COLOR_ID_RED, LED_COLOR_ID_GREEN,
+					 LED_COLOR_ID_BLUE };
+	struct gkbbl_zone_led *led;
+	struct led_classdev *cdev;
+	int zone, i, err;
+
+	for (zone = 0; zone < GAMING_KBBL_ZONES; zone++) {
+		led = &gkbbl_zone_leds[zone];
+		led->zone = zone;
+
+		mutex_lock(&gkbbl_shadow.lock);
+		for (i = 0; i < ARRAY_SIZE(color_ids); i++) {
+			led->subleds[i].color_index = color_ids[i];
+			led->subleds[i].intensity = gkbbl_shadow.zones_valid & BIT(zone) ?
+						    gkbbl_shadow.zone_rgb[zone][i] : 255;
+		}
+		mutex_unlock(&gkbbl_shadow.lock);
+
+		led->mc.subled_info = led->subleds;
+		led->mc.num_colors = ARRAY_SIZE(led->subleds);
+
+		cdev = &led->mc.led_cdev;
+		cdev->name = devm_kasprintf(dev, GFP_KERNEL,
+					    "acer-wmi:rgb:kbd_zoned_backlight-%d", zone + 1);
+		if (!cdev->name)
+			return -ENOMEM;
+		cdev->max_brightness = 255;
+		cdev->brightness = 255;
+		cdev->flags |= LED_RETAIN_AT_SHUTDOWN;
+		cdev->brightness_set_blocking = gkbbl_zone_led_set;
+
+		err = devm_led_classdev_multicolor_register(dev, &led->mc);
+		if (err)
+			return err;
+	}
 
-	device_create(gkbbl_static_dev_class, NULL, gkbbl_static_dev, NULL, "%s-%d",
-				  GAMING_KBBL_STATIC_CHR,
-				  GAMING_KBBL_STATIC_MINOR);
+	gkbbl_kbd_led.brightness = gkbbl_current_brightness();
 
-	return 0;
+	return devm_led_classdev_register(dev, &gkbbl_kbd_led);
 }
 
-static int __init gaming_kbbl_poll_and_enable_zones(void)
+#else
+
+static int gkbbl_leds_init(struct device *dev)
 {
-	u64 gaming_sysinfo;
-	/*
-	 * Querying GetGamingSysInfo appears to be required to enable Nitro AN515-57
-	 * and possibly other Acer (Predator/Nitro) 4 zone LED keyboards.
-	 */
-	WMI_gaming_execute_u64(ACER_WMID_GET_GAMING_SYS_INFO_METHODID, 0, &gaming_sysinfo);
-	/* Turn on all 4 zones */
-	WMI_gaming_execute_u64(ACER_WMID_SET_GAMING_LED_METHODID, 8L | (15UL<<40), NULL);
 	return 0;
 }
 
-static void __exit gaming_kbbl_static_cdev_exit(void)
-{
-	device_destroy(gkbbl_static_dev_class, gkbbl_static_dev);
-
-	class_unregister(gkbbl_static_dev_class);
-	class_destroy(gkbbl_static_dev_class);
-	cdev_del(&gkbbl_static_dev_data.cdev);
-
-	unregister_chrdev_region(gkbbl_static_dev, 1);
-}
+#endif
 
 /*
  * Backlight device
@@ -2657,31 +5992,345 @@ static int acer_gsensor_event(void)
 	return 0;
 }
 
+/*
+ * Sensor reads
+ * Concurrent readers of a sensor share one firmware call: the first one
+ * reads it under the sensor's lock, and the others, waiting for the lock,
+ * take the value read after they arrived. Values younger than
+ * sensor_cache_ms are also served without a firmware call.
+ */
+enum acer_sensor_id {
+	/* Fans and temperatures in hwmon channel order */
+	ACER_SENSOR_CPU_FAN,
+	ACER_SENSOR_GPU_FAN,
+	ACER_SENSOR_CPU_TEMP,
+	ACER_SENSOR_EXT_TEMP,
+	ACER_SENSOR_GPU_TEMP,
+	ACER_SENSOR_COUNT,
+};
+
+#define ACER_SENSOR_FIRST_TEMP ACER_SENSOR_CPU_TEMP
+
+struct acer_sensor {
+	const char *name;
+	const char *label;	/* hwmon label */
+	u8 sensor_id;		/* enum acer_wmi_predator_v4_sensor_id */
+	u64 command;		/* GET_GAMING_SYS_INFO input */
+	struct mutex lock;
+	u64 stamp_ns;		/* When value was read, 0 if never */
+	u64 value;
+	int err;
+
+	/* Statistics, exported through debugfs */
+	u64 reads;
+	u64 calls;
+	u64 probe_ns;		/* Duration of the probe read */
+};
+
+#define ACER_SENSOR(_id, _name, _label, _sensor)			\
+	[_id] = {							\
+		.name = _name,						\
+		.label = _label,					\
+		.sensor_id = _sensor,					\
+		.command = ACER_WMID_CMD_GET_PREDATOR_V4_SENSOR_READING |	\
+			   ((u64)(_sensor) << 8),			\
+		.lock = __MUTEX_INITIALIZER(acer_sensors[_id].lock),	\
+	}
+
+static struct acer_sensor acer_sensors[ACER_SENSOR_COUNT] = {
+	ACER_SENSOR(ACER_SENSOR_CPU_FAN, "cpu_fan", "CPU",
+		    ACER_WMID_SENSOR_CPU_FAN_SPEED),
+	ACER_SENSOR(ACER_SENSOR_GPU_FAN, "gpu_fan", "GPU",
+		    ACER_WMID_SENSOR_GPU_FAN_SPEED),
+	ACER_SENSOR(ACER_SENSOR_CPU_TEMP, "cpu_temp", "CPU",
+		    ACER_WMID_SENSOR_CPU_TEMPERATURE),
+	ACER_SENSOR(ACER_SENSOR_EXT_TEMP, "ext_temp", "External",
+		    ACER_WMID_SENSOR_EXTERNAL_TEMPERATURE_2),
+	ACER_SENSOR(ACER_SENSOR_GPU_TEMP, "gpu_temp", "GPU",
+		    ACER_WMID_SENSOR_GPU_TEMPERATURE),
+};
+
+/* BIT(enum acer_sensor_id) of the sensors found at probe */
+static unsigned long acer_sensors_present;
+
+/* Probe reads slower than this are reported */
+#define ACER_SENSOR_SLOW_NS (50 * NSEC_PER_MSEC)
+
+/* Reads the sensor from the firmware, called with sensor->lock held */
+static void acer_sensor_fetch(struct acer_sensor *sensor)
+{
+	acpi_status status;
+
+	lockdep_assert_held(&sensor->lock);
+
+	status = acer_wmi_call_u64(GET_GAMING_SYS_INFO, sensor->command, &sensor->value);
+	if (ACPI_FAILURE(status) ||
+	    FIELD_GET(ACER_PREDATOR_V4_RETURN_STATUS_BIT_MASK, sensor->value))
+		sensor->err = -EIO;
+	else
+		sensor->err = 0;
+	sensor->stamp_ns = ktime_get_ns();
+	sensor->calls++;
+}
+
+/*
+ * Finds the present sensors once, so that hwmon visibility and the
+ * sampler need no firmware calls. Sensors in the firmware's bitmap, or
+ * the fans if it has none, are read once and kept if the read succeeds.
+ */
+static void acer_sensors_probe(void)
+{
+	struct acer_sensor *sensor;
+	acpi_status status;
+	u64 result, start;
+	u16 supported;
+	int i, err;
+
+	status = acer_wmi_call_u64(GET_GAMING_SYS_INFO,
+				   ACER_WMID_CMD_GET_PREDATOR_V4_SUPPORTED_SENSORS,
+				   &result);
+	if (ACPI_FAILURE(status) ||
+	    FIELD_GET(ACER_PREDATOR_V4_RETURN_STATUS_BIT_MASK, result)) {
+		pr_warn("Could not get the supported sensors, probing the fans\n");
+		supported = BIT(ACER_WMID_SENSOR_CPU_FAN_SPEED - 1) |
+			    BIT(ACER_WMID_SENSOR_GPU_FAN_SPEED - 1);
+	} else {
+		supported = FIELD_GET(ACER_PREDATOR_V4_SUPPORTED_SENSORS_BIT_MASK,
+				      result);
+	}
+
+	for (i = 0; i < ACER_SENSOR_COUNT; i++) {
+		sensor = &acer_sensors[i];
+		if (!(supported & BIT(sensor->sensor_id - 1)))
+			continue;
+
+		mutex_lock(&sensor->lock);
+		start = ktime_get_ns();
+		acer_sensor_fetch(sensor);
+		sensor->probe_ns = sensor->stamp_ns - start;
+		err = sensor->err;
+		mutex_unlock(&sensor->lock);
+
+		if (err) {
+			pr_warn("Could not read the %s sensor: %d\n", sensor->name, err);
+			continue;
+		}
+
+		__set_bit(i, &acer_sensors_present);
+		if (sensor->probe_ns > ACER_SENSOR_SLOW_NS)
+			pr_warn("%s sensor is slow, read took %llu us\n",
+				sensor->name, div_u64(sensor->probe_ns, NSEC_PER_USEC));
+	}
+}
+
+/* Reads the sensor from the firmware, bypassing the cache and the sampler */
+static int acer_sensor_refresh(enum acer_sensor_id id, u64 *value)
+{
+	struct acer_sensor *sensor = &acer_sensors[id];
+	int err;
+
+	mutex_lock(&sensor->lock);
+	acer_sensor_fetch(sensor);
+	*value = sensor->value;
+	err = sensor->err;
+	mutex_unlock(&sensor->lock);
+
+	return err;
+}
+
+/* Fan speed in RPM or temperature in degrees Celsius */
+static u16 acer_sensor_decode(enum acer_sensor_id id, u64 value)
+{
+	if (id < ACER_SENSOR_FIRST_TEMP)
+		return FIELD_GET(ACER_PREDATOR_V4_FAN_SPEED_READ_BIT_MASK, value);
+
+	return FIELD_GET(ACER_PREDATOR_V4_SENSOR_READING_BIT_MASK, value);
+}
+
+/*
+ * Background sampler
+ * With sensor_poll_ms set, the first sensor read starts a delayed work
+ * that refreshes all supported sensors every sensor_poll_ms, and reads
+ * return the last sampled value. The work stops itself once nothing has
+ * been read for sensor_poll_idle_ms and is restarted by the next read.
+ */
+static void acer_sampler_work(struct work_struct *work);
+
+static struct {
+	struct delayed_work work;
+	spinlock_t lock;		/* Protects the fields below */
+	unsigned long last_read;	/* jiffies */
+	bool running;
+	bool shutdown;
+	bool suspended;
+	u64 rounds;
+} acer_sampler = {
+	.work = __DELAYED_WORK_INITIALIZER(acer_sampler.work, acer_sampler_work, 0),
+	.lock = __SPIN_LOCK_UNLOCKED(acer_sampler.lock),
+};
+
+static void acer_sampler_work(struct work_struct *work)
+{
+	unsigned int interval = READ_ONCE(sensor_poll_ms);
+	unsigned int idle = READ_ONCE(sensor_poll_idle_ms);
+	u64 value;
+	int i;
+
+	spin_lock(&acer_sampler.lock);
+	if (!interval || acer_sampler.shutdown || acer_sampler.suspended ||
+	    time_after(jiffies, acer_sampler.last_read + msecs_to_jiffies(idle))) {
+		acer_sampler.running = false;
+		spin_unlock(&acer_sampler.lock);
+		return;
+	}
+	spin_unlock(&acer_sampler.lock);
+
+	for_each_set_bit(i, &acer_sensors_present, ACER_SENSOR_COUNT)
+		acer_sensor_refresh(i, &value);
+
+	spin_lock(&acer_sampler.lock);
+	acer_sampler.rounds++;
+	if (acer_sampler.shutdown || acer_sampler.suspended)
+		acer_sampler.running = false;
+	else
+		schedule_delayed_work(&acer_sampler.work, msecs_to_jiffies(interval));
+	spin_unlock(&acer_sampler.lock);
+}
+
+/*
+ * Notes a sensor read and starts the sampler if needed. Returns true if
+ * the sampler was already running, so the cached value is current.
+ */
+static bool acer_sampler_touch(void)
+{
+	unsigned int interval = READ_ONCE(sensor_poll_ms);
+	bool running;
+
+	if (!interval)
+		return false;
+
+	spin_lock(&acer_sampler.lock);
+	acer_sampler.last_read = jiffies;
+	running = acer_sampler.running;
+	if (!running && !acer_sampler.shutdown && !acer_sampler.suspended) {
+		acer_sampler.running = true;
+		schedule_delayed_work(&acer_sampler.work, msecs_to_jiffies(interval));
+	}
+	spin_unlock(&acer_sampler.lock);
+
+	return running;
+}
+
+static void acer_sampler_stop(void)
+{
+	spin_lock(&acer_sampler.lock);
+	acer_sampler.shutdown = true;
+	spin_unlock(&acer_sampler.lock);
+
+	cancel_delayed_work_sync(&acer_sampler.work);
+}
+
+#ifdef CONFIG_PM_SLEEP
+/* No firmware calls while asleep, the next read after resume restarts it */
+static void acer_sampler_suspend(void)
+{
+	spin_lock(&acer_sampler.lock);
+	acer_sampler.suspended = true;
+	spin_unlock(&acer_sampler.lock);
+
+	cancel_delayed_work_sync(&acer_sampler.work);
+
+	spin_lock(&acer_sampler.lock);
+	acer_sampler.running = false;
+	spin_unlock(&acer_sampler.lock);
+}
+
+static void acer_sampler_resume(void)
+{
+	spin_lock(&acer_sampler.lock);
+	acer_sampler.suspended = false;
+	spin_unlock(&acer_sampler.lock);
+}
+#endif
+
+/* With sampled set, any stored value is served, the sampler keeps it fresh */
+static int __acer_sensor_read(enum acer_sensor_id id, u64 *value, bool sampled)
+{
+	struct acer_sensor *sensor = &acer_sensors[id];
+	u64 window = (u64)READ_ONCE(sensor_cache_ms) * NSEC_PER_MSEC;
+	u64 arrival = ktime_get_ns();
+	int err;
+
+	mutex_lock(&sensor->lock);
+	sensor->reads++;
+	if (sensor->stamp_ns &&
+	    (sampled || sensor->stamp_ns >= arrival ||
+	     ktime_get_ns() - sensor->stamp_ns < window))
+		goto out;
+
+	acer_sensor_fetch(sensor);
+out:
+	*value = sensor->value;
+	err = sensor->err;
+	mutex_unlock(&sensor->lock);
+
+	return err;
+}
+
+static int acer_sensor_read(enum acer_sensor_id id, u64 *value)
+{
+	return __acer_sensor_read(id, value, acer_sampler_touch());
+}
+
+/*
+ * For periodic readers in the kernel, which must not keep the sampler
+ * running when nobody else reads.
+ */
+static int acer_sensor_read_untouched(enum acer_sensor_id id, u64 *value)
+{
+	return __acer_sensor_read(id, value, READ_ONCE(acer_sampler.running));
+}
+
 static int acer_get_fan_speed(int fan)
 {
 	if (quirks->predator_v4) {
-		acpi_status status;
 		u64 fanspeed;
+		int err, rpm;
 
-		status = WMI_gaming_execute_u64(
-			ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
-			fan == 0 ? ACER_WMID_CMD_GET_PREDATOR_V4_CPU_FAN_SPEED :
-				   ACER_WMID_CMD_GET_PREDATOR_V4_GPU_FAN_SPEED,
-			&fanspeed);
+		err = acer_sensor_read(fan == 0 ? ACER_SENSOR_CPU_FAN : ACER_SENSOR_GPU_FAN,
+				       &fanspeed);
+		if (err)
+			return err;
 
-		if (ACPI_FAILURE(status))
-			return -EIO;
+		rpm = acer_sensor_decode(fan, fanspeed);
+		acer_state_set(fan_rpm[fan], rpm);
 
-		return FIELD_GET(ACER_PREDATOR_V4_FAN_SPEED_READ_BIT_MASK, fanspeed);
+		return rpm;
 	}
 	return -EOPNOTSUPP;
 }
 
+/* Returns the temperature in millidegrees Celsius */
+static int acer_get_temperature(enum acer_sensor_id id, long *temp)
+{
+	u64 reading;
+	int err;
+
+	err = acer_sensor_read(id, &reading);
+	if (err)
+		return err;
+
+	*temp = acer_sensor_decode(id, reading) * 1000;
+
+	return 0;
+}
+
 /*
  *  Predator series turbo button
  */
 static void acer_toggle_turbo(void)
 {
+	mutex_lock(&acer_thermal_lock);
 	if (turbo_state) {
 		turbo_state = 0;
 		/* Turn off turbo led */
@@ -2705,6 +6354,8 @@ static void acer_toggle_turbo(void)
 		WMID_gaming_set_u64(0x205, ACER_CAP_TURBO_OC);
 		WMID_gaming_set_u64(0x207, ACER_CAP_TURBO_OC);
 	}
+	acer_state_set(turbo, turbo_state);
+	mutex_unlock(&acer_thermal_lock);
 }
 
 #if RTLNX_VER_MIN(6, 14, 0)
@@ -2717,18 +6368,32 @@ acer_predator_v4_platform_profile_get(struct platform_profile_handler *pprof,
 						enum platform_profile_option *profile)
 #endif
 {
+	struct acer_state state;
 	u8 tp;
 	int err;
 
+	/*
+	 * Every profile change made through the driver publishes the new
+	 * profile, or -1 when it must be read back from the firmware.
+	 */
+	acer_state_get(&state);
+	if (state.profile >= 0) {
+		*profile = state.profile;
+		return 0;
+	}
+
+	/* Not racing a change, which would publish -1 after our stale read */
+	mutex_lock(&acer_thermal_lock);
 #if RTLNX_VER_MIN(6, 14, 0)
 	err = WMID_gaming_get_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, &tp);
 	if (err)
-		return err;
+		goto out_unlock;
 #else
-	err = ec_read(ACER_PREDATOR_V4_THERMAL_PROFILE_EC_OFFSET, &tp);
+	err = acer_ec_read(ACER_PREDATOR_V4_THERMAL_PROFILE_EC_OFFSET, &tp);
 
 	if (err < 0)
-		return err;
+		goto out_unlock;
+	err = 0;
 #endif
 
 	switch (tp) {
@@ -2748,10 +6413,14 @@ acer_predator_v4_platform_profile_get(struct platform_profile_handler *pprof,
 		*profile = PLATFORM_PROFILE_LOW_POWER;
 		break;
 	default:
-		return -EOPNOTSUPP;
+		err = -EOPNOTSUPP;
+		goto out_unlock;
 	}
+	acer_state_set(profile, *profile);
 
-	return 0;
+out_unlock:
+	mutex_unlock(&acer_thermal_lock);
+	return err;
 }
 
 #if RTLNX_VER_MIN(6, 14, 0)
@@ -2786,21 +6455,21 @@ acer_predator_v4_platform_profile_set(struct platform_profile_handler *pprof,
 		return -EOPNOTSUPP;
 	}
 
+	mutex_lock(&acer_thermal_lock);
 	#if RTLNX_VER_MIN(6, 14, 0)
 	err = WMID_gaming_set_misc_setting(ACER_WMID_MISC_SETTING_PLATFORM_PROFILE, tp);
-	if (err)
-		return err;
 	#else
-	acpi_status status;
-	status = WMI_gaming_execute_u64(
-		ACER_WMID_SET_GAMING_MISC_SETTING_METHODID, tp, NULL);
-
-	if (ACPI_FAILURE(status))
-		return -EIO;
+	err = ACPI_FAILURE(acer_wmi_call_u64(SET_GAMING_MISC, tp, NULL)) ? -EIO : 0;
 	#endif
+	if (err) {
+		mutex_unlock(&acer_thermal_lock);
+		return err;
+	}
 
 	if (tp != acer_predator_v4_max_perf)
 		last_non_turbo_profile = tp;
+	acer_state_set(profile, profile);
+	mutex_unlock(&acer_thermal_lock);
 
 	return 0;
 }
@@ -2817,6 +6486,7 @@ acer_predator_v4_platform_profile_probe(void *drvdata, unsigned long *choices)
 	if (err)
 		return err;
 
+	mutex_lock(&acer_thermal_lock);
 	/* Iterate through supported profiles in order of increasing performance */
 	if (test_bit(ACER_PREDATOR_V4_THERMAL_PROFILE_ECO, &supported_profiles)) {
 		set_bit(PLATFORM_PROFILE_LOW_POWER, choices);
@@ -2858,6 +6528,7 @@ acer_predator_v4_platform_profile_probe(void *drvdata, unsigned long *choices)
 		if (last_non_turbo_profile < 0)
 			last_non_turbo_profile = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO;
 	}
+	mutex_unlock(&acer_thermal_lock);
 
 	return 0;
 }
@@ -2879,8 +6550,10 @@ static int acer_platform_profile_setup(struct platform_device *device)
 		platform_profile_support = true;
 
 		/* Set default non-turbo profile  */
+		mutex_lock(&acer_thermal_lock);
 		last_non_turbo_profile =
 			ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED_WMI;
+		mutex_unlock(&acer_thermal_lock);
 	}
 	return 0;
 }
@@ -2914,8 +6587,10 @@ static int acer_platform_profile_setup(void)
 		platform_profile_support = true;
 
 		/* Set default non-turbo profile  */
+		mutex_lock(&acer_thermal_lock);
 		last_non_turbo_profile =
 			ACER_PREDATOR_V4_THERMAL_PROFILE_BALANCED_WMI;
+		mutex_unlock(&acer_thermal_lock);
 	}
 	return 0;
 }
@@ -2933,19 +6608,21 @@ static int acer_thermal_profile_change(void)
 		u64 on_AC;
 		acpi_status status;
 
-		err = ec_read(ACER_PREDATOR_V4_THERMAL_PROFILE_EC_OFFSET,
+		mutex_lock(&acer_thermal_lock);
+		err = acer_ec_read(ACER_PREDATOR_V4_THERMAL_PROFILE_EC_OFFSET,
 			      &current_tp);
 
 		if (err < 0)
-			return err;
+			goto out_unlock;
 
 		/* Check power source */
-		status = WMI_gaming_execute_u64(
-			ACER_WMID_GET_GAMING_SYS_INFO_METHODID,
+		status = acer_wmi_call_u64(GET_GAMING_SYS_INFO,
 			ACER_WMID_CMD_GET_PREDATOR_V4_BAT_STATUS, &on_AC);
 
-		if (ACPI_FAILURE(status))
-			return -EIO;
+		if (ACPI_FAILURE(status)) {
+			err = -EIO;
+			goto out_unlock;
+		}
 
 		switch (current_tp) {
 		case ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO:
@@ -2987,24 +6664,34 @@ static int acer_thermal_profile_change(void)
 				tp = ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO_WMI;
 			break;
 		default:
-			return -EOPNOTSUPP;
+			err = -EOPNOTSUPP;
+			goto out_unlock;
 		}
 
-		status = WMI_gaming_execute_u64(
-			ACER_WMID_SET_GAMING_MISC_SETTING_METHODID, tp, NULL);
+		status = acer_wmi_call_u64(SET_GAMING_MISC, tp, NULL);
 
-		if (ACPI_FAILURE(status))
-			return -EIO;
+		if (ACPI_FAILURE(status)) {
+			err = -EIO;
+			goto out_unlock;
+		}
 
 		/* Store non-turbo profile for turbo mode toggle*/
 		if (tp != ACER_PREDATOR_V4_THERMAL_PROFILE_TURBO_WMI)
 			last_non_turbo_profile = tp;
+		/* Unknown until the notified readers fetch it again */
+		acer_state_set(profile, -1);
+		mutex_unlock(&acer_thermal_lock);
 		
 		#if RTLNX_VER_MIN(6, 14, 0)
 		platform_profile_notify(platform_profile_device);
 		#else
 		platform_profile_notify();
 		#endif
+		return 0;
+
+out_unlock:
+		mutex_unlock(&acer_thermal_lock);
+		return err;
 	}
 
 	return 0;
@@ -3032,19 +6719,19 @@ static void acer_kbd_dock_get_initial_state(void)
 {
 	u8 *output, input[8] = { 0x05, 0x00, };
 	struct acpi_buffer input_buf = { sizeof(input), input };
-	struct acpi_buffer output_buf = { ACPI_ALLOCATE_BUFFER, NULL };
+	struct acer_wmi_result output_buf;
 	union acpi_object *obj;
 	acpi_status status;
 	int sw_tablet_mode;
 
-	status = wmi_evaluate_method(WMID_GUID3, 0, 0x2, &input_buf, &output_buf);
+	status = acer_wmi_evaluate(WMID_GUID3, 0x2, &input_buf, 8, &output_buf);
 	if (ACPI_FAILURE(status)) {
 		pr_err("Error getting keyboard-dock initial status: %s\n",
 		       acpi_format_exception(status));
-		return;
+		goto out_free_obj;
 	}
 
-	obj = output_buf.pointer;
+	obj = output_buf.obj;
 	if (!obj || obj->type != ACPI_TYPE_BUFFER || obj->buffer.length != 8) {
 		pr_err("Unexpected output format getting keyboard-dock initial status\n");
 		goto out_free_obj;
@@ -3061,7 +6748,7 @@ static void acer_kbd_dock_get_initial_state(void)
 	input_report_switch(acer_wmi_input_dev, SW_TABLET_MODE, sw_tablet_mode);
 
 out_free_obj:
-	kfree(obj);
+	acer_wmi_result_free(&output_buf);
 }
 
 static void acer_kbd_dock_event(const struct event_return_value *event)
@@ -3086,6 +6773,7 @@ static void acer_rfkill_update(struct work_struct *ignored)
 	u32 state;
 	acpi_status status;
 
+	mutex_lock(&acer_radio_lock);
 	if (has_cap(ACER_CAP_WIRELESS)) {
 		status = get_u32(&state, ACER_CAP_WIRELESS);
 		if (ACPI_SUCCESS(status)) {
@@ -3102,11 +6790,12 @@ static void acer_rfkill_update(struct work_struct *ignored)
 			rfkill_set_sw_state(bluetooth_rfkill, !state);
 	}
 
-	if (has_cap(ACER_CAP_THREEG) && wmi_has_guid(WMID_GUID3)) {
-		status = get_u32(&state, ACER_WMID3_GDS_THREEG);
+	if (has_cap(ACER_CAP_THREEG) && has_guid(ACER_GUID_WMID_3)) {
+		status = get_u32(&state, ACER_CAP_THREEG);
 		if (ACPI_SUCCESS(status))
 			rfkill_set_sw_state(threeg_rfkill, !state);
 	}
+	mutex_unlock(&acer_radio_lock);
 
 	schedule_delayed_work(&acer_rfkill_work, round_jiffies_relative(HZ));
 }
@@ -3117,7 +6806,9 @@ static int acer_rfkill_set(void *data, bool blocked)
 	u32 cap = (unsigned long)data;
 
 	if (rfkill_inited) {
+		mutex_lock(&acer_radio_lock);
 		status = set_u32(!blocked, cap);
+		mutex_unlock(&acer_radio_lock);
 		if (ACPI_FAILURE(status))
 			return -ENODEV;
 	}
@@ -3193,7 +6884,7 @@ static int acer_rfkill_init(struct device *dev)
 
 	rfkill_inited = true;
 
-	if ((ec_raw_mode || !wmi_has_guid(ACERWMID_EVENT_GUID)) &&
+	if ((ec_raw_mode || !has_guid(ACER_GUID_EVENT)) &&
 	    has_cap(ACER_CAP_WIRELESS | ACER_CAP_BLUETOOTH | ACER_CAP_THREEG))
 		schedule_delayed_work(&acer_rfkill_work,
 			round_jiffies_relative(HZ));
@@ -3216,7 +6907,7 @@ error_wireless:
 
 static void acer_rfkill_exit(void)
 {
-	if ((ec_raw_mode || !wmi_has_guid(ACERWMID_EVENT_GUID)) &&
+	if ((ec_raw_mode || !has_guid(ACER_GUID_EVENT)) &&
 	    has_cap(ACER_CAP_WIRELESS | ACER_CAP_BLUETOOTH | ACER_CAP_THREEG))
 		cancel_delayed_work_sync(&acer_rfkill_work);
 
@@ -3236,50 +6927,26 @@ static void acer_rfkill_exit(void)
 	}
 }
 
-static void acer_wmi_notify(
-#if RTLNX_VER_MIN(6, 12, 0)
-	union acpi_object *obj
-#else
-	u32 value
-#endif
-	, void *context)
+static void acer_wmi_handle_event(struct event_return_value return_value)
 {
-	struct event_return_value return_value;
 	u16 device_state;
 	const struct key_entry *key;
 	u32 scancode;
 
-#if RTLNX_VER_MAX(6, 12, 0)
-	struct acpi_buffer response = { ACPI_ALLOCATE_BUFFER, NULL };
-	acpi_status status = wmi_get_event_data(value, &response);
-	if (status != AE_OK) {
-		pr_warn("bad event status 0x%x\n", status);
-		return;
-	}
-	union acpi_object *obj = (union acpi_object *)response.pointer;
-#endif
+	trace_acer_wmi_event(return_value.function, return_value.key_num,
+			     return_value.device_state, return_value.kbd_dock_state);
 
-	if (!obj)
-		return;
-	if (obj->type != ACPI_TYPE_BUFFER) {
-		pr_warn("Unknown response received %d\n", obj->type);
-#if RTLNX_VER_MAX(6, 12, 0)
-		kfree(obj);
-#endif
-		return;
-	}
-	if (obj->buffer.length != 8) {
-		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
-#if RTLNX_VER_MAX(6, 12, 0)
-		kfree(obj);
-#endif
-		return;
-	}
+	if (READ_ONCE(acer_rec.enabled)) {
+		struct acer_rec rec = {
+			.id = cpu_to_le32(return_value.function),
+			.type = ACER_REC_EVENT,
+		};
 
-	return_value = *((struct event_return_value *)obj->buffer.pointer);
-#if RTLNX_VER_MAX(6, 12, 0)
-	kfree(obj);
-#endif
+		acer_rec_guid(ACERWMID_EVENT_GUID, &rec.guid);
+
+		acer_rec_add(&rec, ktime_get_ns(), &return_value,
+			     sizeof(return_value), NULL, 0);
+	}
 
 	switch (return_value.function) {
 	case WMID_HOTKEY_EVENT:
@@ -3325,9 +6992,10 @@ static void acer_wmi_notify(
 			 * events are generated by the actual macro keys,
 			 * key_num = 0x2)
 			 */
-			if(return_value.device_state >= 1 && return_value.device_state <= 3)
+			if(return_value.device_state >= 1 && return_value.device_state <= 3) {
 				macro_key_state = return_value.device_state - 1;
-			else
+				acer_state_set(macro_key, macro_key_state);
+			} else
 				pr_warn("macro key state %d requested (only values 1 to 3 are known)\n", return_value.device_state);
 			break;
 		}
@@ -3350,6 +7018,51 @@ static void acer_wmi_notify(
 	}
 }
 
+static void acer_wmi_notify(
+#if RTLNX_VER_MIN(6, 12, 0)
+	union acpi_object *obj
+#else
+	u32 value
+#endif
+	, void *context)
+{
+	struct event_return_value return_value;
+
+#if RTLNX_VER_MAX(6, 12, 0)
+	struct acpi_buffer response = { ACPI_ALLOCATE_BUFFER, NULL };
+	acpi_status status = wmi_get_event_data(value, &response);
+	if (status != AE_OK) {
+		pr_warn("bad event status 0x%x\n", status);
+		return;
+	}
+	union acpi_object *obj = (union acpi_object *)response.pointer;
+#endif
+
+	if (!obj)
+		return;
+	if (obj->type != ACPI_TYPE_BUFFER) {
+		pr_warn("Unknown response received %d\n", obj->type);
+#if RTLNX_VER_MAX(6, 12, 0)
+		kfree(obj);
+#endif
+		return;
+	}
+	if (obj->buffer.length != 8) {
+		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
+#if RTLNX_VER_MAX(6, 12, 0)
+		kfree(obj);
+#endif
+		return;
+	}
+
+	return_value = *((struct event_return_value *)obj->buffer.pointer);
+#if RTLNX_VER_MAX(6, 12, 0)
+	kfree(obj);
+#endif
+
+	acer_wmi_handle_event(return_value);
+}
+
 static acpi_status __init
 wmid3_set_function_mode(struct func_input_params *params,
 			struct func_return_value *return_value)
@@ -3358,29 +7071,29 @@ wmid3_set_function_mode(struct func_input_params *params,
 	union acpi_object *obj;
 
 	struct acpi_buffer input = { sizeof(struct func_input_params), params };
-	struct acpi_buffer output = { ACPI_ALLOCATE_BUFFER, NULL };
+	struct acer_wmi_result output;
 
-	status = wmi_evaluate_method(WMID_GUID3, 0, 0x1, &input, &output);
+	status = acer_wmi_evaluate(WMID_GUID3, 0x1, &input,
+				   ACER_WMI_RESULT_ALLOC, &output);
 	if (ACPI_FAILURE(status))
-		return status;
+		goto out_free;
 
-	obj = output.pointer;
+	obj = output.obj;
 
-	if (!obj)
-		return AE_ERROR;
-	else if (obj->type != ACPI_TYPE_BUFFER) {
-		kfree(obj);
-		return AE_ERROR;
+	if (!obj || obj->type != ACPI_TYPE_BUFFER) {
+		status = AE_ERROR;
+		goto out_free;
 	}
 	if (obj->buffer.length != 4) {
 		pr_warn("Unknown buffer length %d\n", obj->buffer.length);
-		kfree(obj);
-		return AE_ERROR;
+		status = AE_ERROR;
+		goto out_free;
 	}
 
 	*return_value = *((struct func_return_value *)obj->buffer.pointer);
-	kfree(obj);
 
+out_free:
+	acer_wmi_result_free(&output);
 	return status;
 }
 
@@ -3509,11 +7222,14 @@ static int __init acer_wmi_input_setup(void)
 	if (has_cap(ACER_CAP_KBD_DOCK))
 		input_set_capability(acer_wmi_input_dev, EV_SW, SW_TABLET_MODE);
 
-	status = wmi_install_notify_handler(ACERWMID_EVENT_GUID,
-						acer_wmi_notify, NULL);
-	if (ACPI_FAILURE(status)) {
-		err = -EIO;
-		goto err_free_dev;
+	/* Simulated events are injected through debugfs */
+	if (!mock) {
+		status = wmi_install_notify_handler(ACERWMID_EVENT_GUID,
+						    acer_wmi_notify, NULL);
+		if (ACPI_FAILURE(status)) {
+			err = -EIO;
+			goto err_free_dev;
+		}
 	}
 
 	if (has_cap(ACER_CAP_KBD_DOCK))
@@ -3526,7 +7242,8 @@ static int __init acer_wmi_input_setup(void)
 	return 0;
 
 err_uninstall_notifier:
-	wmi_remove_notify_handler(ACERWMID_EVENT_GUID);
+	if (!mock)
+		wmi_remove_notify_handler(ACERWMID_EVENT_GUID);
 err_free_dev:
 	input_free_device(acer_wmi_input_dev);
 	return err;
@@ -3534,7 +7251,8 @@ err_free_dev:
 
 static void acer_wmi_input_destroy(void)
 {
-	wmi_remove_notify_handler(ACERWMID_EVENT_GUID);
+	if (!mock)
+		wmi_remove_notify_handler(ACERWMID_EVENT_GUID);
 	input_unregister_device(acer_wmi_input_dev);
 }
 
@@ -3543,16 +7261,18 @@ static void acer_wmi_input_destroy(void)
  */
 static u32 get_wmid_devices(void)
 {
-	struct acpi_buffer out = {ACPI_ALLOCATE_BUFFER, NULL};
+	struct acer_wmi_result out;
 	union acpi_object *obj;
 	acpi_status status;
 	u32 devices = 0;
 
-	status = wmi_query_block(WMID_GUID2, 0, &out);
-	if (ACPI_FAILURE(status))
+	status = acer_wmi_query(WMID_GUID2, &out);
+	if (ACPI_FAILURE(status)) {
+		acer_wmi_result_free(&out);
 		return 0;
+	}
 
-	obj = (union acpi_object *) out.pointer;
+	obj = out.obj;
 	if (obj) {
 		if (obj->type == ACPI_TYPE_BUFFER &&
 			(obj->buffer.length == sizeof(u32) ||
@@ -3563,11 +7283,13 @@ static u32 get_wmid_devices(void)
 		}
 	}
 
-	kfree(out.pointer);
+	acer_wmi_result_free(&out);
 	return devices;
 }
 
 static int acer_wmi_hwmon_init(void);
+static int acer_iio_init(struct device *dev);
+static int acer_thermal_init(struct device *dev);
 
 /*
  * Platform device
@@ -3602,111 +7324,670 @@ static int acer_platform_probe(struct platform_device *device)
 			goto error_platform_profile;
 	}
 
-	if (has_cap(ACER_CAP_FAN_SPEED_READ)) {
-		err = acer_wmi_hwmon_init();
-		if (err)
-			goto error_hwmon;
-	}
+	if (has_cap(ACER_CAP_FAN_SPEED_READ)) {
+		err = acer_wmi_hwmon_init();
+		if (err)
+			goto error_hwmon;
+
+		/* Optional, hwmon still has the sensors */
+		err = acer_iio_init(&device->dev);
+		if (err)
+			dev_warn(&device->dev, "Could not register the IIO device: %d\n",
+				 err);
+
+		err = acer_thermal_init(&device->dev);
+		if (err)
+			dev_warn(&device->dev, "Could not register the thermal zones: %d\n",
+				 err);
+	}
+
+	if (gaming_interface &&
+	    (gaming_interface->capability & ACER_CAP_GAMINGKB_STATIC)) {
+		err = gkbbl_leds_init(&device->dev);
+		if (err)
+			goto error_gkbbl_leds;
+	}
+
+	return 0;
+
+	error_gkbbl_leds:
+		acer_sampler_stop();
+	error_hwmon:
+	error_platform_profile:
+		acer_rfkill_exit();
+	error_rfkill:
+		if (has_cap(ACER_CAP_BRIGHTNESS))
+			acer_backlight_exit();
+	error_brightness:
+		if (has_cap(ACER_CAP_MAILLED))
+			acer_led_exit();
+	error_mailled:
+		return err;
+}
+
+static void acer_platform_remove(struct platform_device *device)
+{
+	if (has_cap(ACER_CAP_MAILLED))
+		acer_led_exit();
+	if (has_cap(ACER_CAP_BRIGHTNESS))
+		acer_backlight_exit();
+
+	acer_rfkill_exit();
+}
+
+#ifdef CONFIG_PM_SLEEP
+static int acer_suspend(struct device *dev)
+{
+	u32 value;
+	struct acer_data *data = &interface->data;
+
+	if (!data)
+		return -ENOMEM;
+
+	if (has_cap(ACER_CAP_MAILLED)) {
+		get_u32(&value, ACER_CAP_MAILLED);
+		set_u32(LED_OFF, ACER_CAP_MAILLED);
+		data->mailled = value;
+	}
+
+	if (has_cap(ACER_CAP_BRIGHTNESS)) {
+		get_u32(&value, ACER_CAP_BRIGHTNESS);
+		data->brightness = value;
+	}
+
+	acer_sampler_suspend();
+
+	return 0;
+}
+
+static int acer_resume(struct device *dev)
+{
+	struct acer_data *data = &interface->data;
+
+	if (!data)
+		return -ENOMEM;
+
+	if (has_cap(ACER_CAP_MAILLED))
+		set_u32(data->mailled, ACER_CAP_MAILLED);
+
+	if (has_cap(ACER_CAP_BRIGHTNESS))
+		set_u32(data->brightness, ACER_CAP_BRIGHTNESS);
+
+	/* The firmware may have reset the profile while asleep */
+	acer_state_set(profile, -1);
+
+	acer_sampler_resume();
+
+	/* The firmware may have reset the keyboard backlight while asleep */
+	if (gaming_interface) {
+		gkbbl_shadow_invalidate();
+		if (gaming_interface->capability & ACER_CAP_GAMINGKB)
+			gkbbl_shadow_readback();
+	}
+
+	if (acer_wmi_accel_dev)
+		acer_gsensor_init();
+
+	return 0;
+}
+#else
+#define acer_suspend	NULL
+#define acer_resume	NULL
+#endif
+
+static SIMPLE_DEV_PM_OPS(acer_pm, acer_suspend, acer_resume);
+
+static void acer_platform_shutdown(struct platform_device *device)
+{
+	struct acer_data *data = &interface->data;
+
+	if (!data)
+		return;
+
+	if (has_cap(ACER_CAP_MAILLED))
+		set_u32(LED_OFF, ACER_CAP_MAILLED);
+}
+
+static struct platform_driver acer_platform_driver = {
+		.driver = {
+				.name = "acer-wmi",
+				.pm = &acer_pm,
+		},
+		.probe = acer_platform_probe,
+		#if RTLNX_VER_MIN(6, 14, 0)
+		.remove = acer_platform_remove,
+		#else
+		.remove = (void*)acer_platform_remove,
+		#endif
+		.shutdown = acer_platform_shutdown,
+};
+
+static struct platform_device *acer_platform_device;
+
+static const char *acer_lat_guid_name(const char *guid)
+{
+	static const struct {
+		const char *guid;
+		const char *name;
+	} names[] = {
+		{ AMW0_GUID1, "AMW0_GUID1" },
+		{ WMID_GUID1, "WMID_GUID1" },
+		{ WMID_GUID2, "WMID_GUID2" },
+		{ WMID_GUID3, "WMID_GUID3" },
+		{ WMID_GUID4, "WMID_GUID4" },
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (!strcmp(names[i].guid, guid))
+			return names[i].name;
+	}
+
+	return guid;
+}
+
+/* Upper bound of the bucket holding the given per mille of the calls */
+static u64 acer_lat_percentile(const struct acer_lat_entry *entry, unsigned int permille)
+{
+	u64 rank = div_u64(entry->count * permille + 999, 1000);
+	u64 seen = 0;
+	int i;
+
+	for (i = 0; i < ACER_LAT_BUCKETS; i++) {
+		seen += entry->buckets[i];
+		if (seen >= rank)
+			return min(BIT_ULL(i), entry->max_ns);
+	}
+
+	return entry->max_ns;
+}
+
+static int acer_lat_show(struct seq_file *m, void *v)
+{
+	struct acer_lat_entry *entries, *entry;
+	unsigned int nr, i, j;
+	u64 dropped;
+
+	entries = kmalloc_array(ACER_LAT_MAX_ENTRIES, sizeof(*entries), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	spin_lock_irq(&acer_lat.lock);
+	nr = acer_lat.nr_entries;
+	memcpy(entries, acer_lat.entries, nr * sizeof(*entries));
+	dropped = acer_lat.dropped;
+	spin_unlock_irq(&acer_lat.lock);
+
+	seq_puts(m, "# guid method count min_ns mean_ns max_ns p50_ns p99_ns p999_ns\n");
+	for (i = 0; i < nr; i++) {
+		entry = &entries[i];
+
+		seq_printf(m, "%s ", acer_lat_guid_name(entry->guid));
+		if (entry->method_id == ACER_LAT_QUERY)
+			seq_puts(m, "query");
+		else
+			seq_printf(m, "%u", entry->method_id);
+
+		seq_printf(m, " %llu %llu %llu %llu %llu %llu %llu\n",
+			   entry->count, entry->min_ns,
+			   div64_u64(entry->total_ns, entry->count), entry->max_ns,
+			   acer_lat_percentile(entry, 500),
+			   acer_lat_percentile(entry, 990),
+			   acer_lat_percentile(entry, 999));
+
+		seq_puts(m, "  buckets(<2^n ns):");
+		for (j = 0; j < ACER_LAT_BUCKETS; j++) {
+			if (entry->buckets[j])
+				seq_printf(m, " %u:%llu", j, entry->buckets[j]);
+		}
+		seq_putc(m, '\n');
+	}
+
+	if (dropped)
+		seq_printf(m, "# %llu calls not recorded, table full\n", dropped);
+
+	kfree(entries);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(acer_lat);
+
+static int acer_cmd_stats_show(struct seq_file *m, void *v)
+{
+	struct acer_cmd_stats stats[ACER_CMD_NR_CLASSES];
+	int class;
+
+	spin_lock(&acer_sched.lock);
+	memcpy(stats, acer_sched.stats, sizeof(stats));
+	spin_unlock(&acer_sched.lock);
+
+	seq_puts(m, "# class submitted executed inline promoted depth max_depth wait_mean_ns wait_max_ns\n");
+	for (class = 0; class < ACER_CMD_NR_CLASSES; class++) {
+		seq_printf(m, "%s %llu %llu %llu %llu %u %u %llu %llu\n",
+			   acer_cmd_class_names[class], stats[class].submitted,
+			   stats[class].executed, stats[class].inline_runs,
+			   stats[class].promoted,
+			   stats[class].depth, stats[class].max_depth,
+			   stats[class].executed ?
+			   div64_u64(stats[class].wait_total_ns, stats[class].executed) : 0,
+			   stats[class].wait_max_ns);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(acer_cmd_stats);
+
+static int acer_state_show(struct seq_file *m, void *v)
+{
+	struct acer_state state;
+
+	acer_state_get(&state);
+
+	seq_printf(m, "profile: %d\n", state.profile);
+	seq_printf(m, "turbo: %d\n", state.turbo);
+	seq_printf(m, "macro_key: %u\n", state.macro_key);
+	seq_printf(m, "fan_rpm: %d %d\n", state.fan_rpm[0], state.fan_rpm[1]);
+	if (state.gkbbl_known)
+		seq_printf(m, "gkbbl_config: %*phN\n", GAMING_KBBL_CONFIG_LEN,
+			   state.gkbbl_config);
+	else
+		seq_puts(m, "gkbbl_config: unknown\n");
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(acer_state);
+
+static int acer_sensors_show(struct seq_file *m, void *v)
+{
+	struct acer_sensor *sensor;
+	u64 reads, calls, stamp, probe_ns;
+	s64 age_ms;
+	bool running;
+	u64 rounds;
+	int i;
+
+	seq_puts(m, "# sensor present reads firmware_calls age_ms probe_us\n");
+	for (i = 0; i < ACER_SENSOR_COUNT; i++) {
+		sensor = &acer_sensors[i];
+
+		mutex_lock(&sensor->lock);
+		reads = sensor->reads;
+		calls = sensor->calls;
+		stamp = sensor->stamp_ns;
+		probe_ns = sensor->probe_ns;
+		mutex_unlock(&sensor->lock);
+
+		/* -1 if never read */
+		age_ms = stamp ? div_u64(ktime_get_ns() - stamp, NSEC_PER_MSEC) : -1;
+		seq_printf(m, "%s %d %llu %llu %lld %llu%s\n", sensor->name,
+			   test_bit(i, &acer_sensors_present), reads, calls,
+			   age_ms, div_u64(probe_ns, NSEC_PER_USEC),
+			   probe_ns > ACER_SENSOR_SLOW_NS ? " slow" : "");
+	}
+
+	spin_lock(&acer_sampler.lock);
+	running = acer_sampler.running;
+	rounds = acer_sampler.rounds;
+	spin_unlock(&acer_sampler.lock);
+
+	seq_printf(m, "sampler %s rounds %llu\n", running ? "running" : "stopped",
+		   rounds);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(acer_sensors);
+
+static ssize_t acer_lat_reset_write(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	spin_lock_irq(&acer_lat.lock);
+	acer_lat.nr_entries = 0;
+	acer_lat.dropped = 0;
+	memset(acer_lat.entries, 0, sizeof(acer_lat.entries));
+	spin_unlock_irq(&acer_lat.lock);
+
+	return count;
+}
+
+static const struct file_operations acer_lat_reset_fops = {
+	.owner = THIS_MODULE,
+	.write = acer_lat_reset_write,
+};
+
+/* Injected events are handled one at a time, like ACPI notifications */
+static DEFINE_MUTEX(acer_event_lock);
+
+/* "function key_num device_state [kbd_dock_state]", as the firmware sends */
+static ssize_t acer_mock_event_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct event_return_value event = {};
+	u32 function, key_num, device_state, kbd_dock_state = 0;
+	char line[64];
+
+	if (count >= sizeof(line))
+		return -EINVAL;
+	if (copy_from_user(line, buf, count))
+		return -EFAULT;
+	line[count] = '\0';
+
+	if (sscanf(line, "%i %i %i %i", &function, &key_num, &device_state,
+		   &kbd_dock_state) < 3)
+		return -EINVAL;
+	if (function > U8_MAX || key_num > U8_MAX || device_state > U16_MAX ||
+	    kbd_dock_state > U8_MAX)
+		return -EINVAL;
+
+	event.function = function;
+	event.key_num = key_num;
+	event.device_state = device_state;
+	event.kbd_dock_state = kbd_dock_state;
+
+	mutex_lock(&acer_event_lock);
+	acer_wmi_handle_event(event);
+	mutex_unlock(&acer_event_lock);
+
+	return count;
+}
+
+static const struct file_operations acer_mock_event_fops = {
+	.owner = THIS_MODULE,
+	.write = acer_mock_event_write,
+};
+
+static struct debugfs_blob_wrapper acer_mock_ec_blob = {
+	.data = acer_mock.ec,
+	.size = sizeof(acer_mock.ec),
+};
+
+static void __init acer_mock_create_debugfs(struct dentry *root)
+{
+	struct dentry *dir = debugfs_create_dir("mock", root);
+
+	if (has_guid(ACER_GUID_EVENT))
+		debugfs_create_file("event", 0200, dir, NULL, &acer_mock_event_fops);
+	debugfs_create_blob("ec", 0444, dir, &acer_mock_ec_blob);
+	debugfs_create_x16("devices", 0644, dir, &acer_mock.devices);
+	debugfs_create_u8("kbd_dock", 0644, dir, &acer_mock.kbd_dock);
+	debugfs_create_u16("cpu_fan_rpm", 0644, dir, &acer_mock.fan_rpm[0]);
+	debugfs_create_u16("gpu_fan_rpm", 0644, dir, &acer_mock.fan_rpm[1]);
+	debugfs_create_u8("cpu_temp", 0644, dir, &acer_mock.cpu_temp);
+	debugfs_create_u8("ext_temp", 0644, dir, &acer_mock.ext_temp);
+	debugfs_create_u8("gpu_temp", 0644, dir, &acer_mock.gpu_temp);
+	debugfs_create_bool("on_ac", 0644, dir, &acer_mock.on_ac);
+}
+
+static int acer_rec_start(void)
+{
+	int err = 0;
+
+	mutex_lock(&acer_rec.read_lock);
+	if (!kfifo_initialized(&acer_rec.ring)) {
+		err = kfifo_alloc(&acer_rec.ring, record_kb * 1024, GFP_KERNEL);
+		if (err)
+			goto out;
+	}
+
+	spin_lock(&acer_rec.lock);
+	kfifo_reset(&acer_rec.ring);
+	acer_rec.records = 0;
+	acer_rec.dropped = 0;
+	acer_rec.start_ns = ktime_get_ns();
+	WRITE_ONCE(acer_rec.enabled, true);
+	spin_unlock(&acer_rec.lock);
+out:
+	mutex_unlock(&acer_rec.read_lock);
+	return err;
+}
+
+static void acer_rec_stop(void)
+{
+	spin_lock(&acer_rec.lock);
+	WRITE_ONCE(acer_rec.enabled, false);
+	spin_unlock(&acer_rec.lock);
+}
+
+static int acer_rec_enable_get(void *data, u64 *val)
+{
+	*val = READ_ONCE(acer_rec.enabled);
+	return 0;
+}
+
+static int acer_rec_enable_set(void *data, u64 val)
+{
+	if (val)
+		return acer_rec_start();
 
+	acer_rec_stop();
 	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(acer_rec_enable_fops, acer_rec_enable_get,
+			 acer_rec_enable_set, "%llu\n");
 
-	error_hwmon:
-	error_platform_profile:
-		acer_rfkill_exit();
-	error_rfkill:
-		if (has_cap(ACER_CAP_BRIGHTNESS))
-			acer_backlight_exit();
-	error_brightness:
-		if (has_cap(ACER_CAP_MAILLED))
-			acer_led_exit();
-	error_mailled:
+/* Reading consumes the records */
+static ssize_t acer_rec_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	unsigned int copied = 0;
+	int err = 0;
+
+	mutex_lock(&acer_rec.read_lock);
+	if (kfifo_initialized(&acer_rec.ring))
+		err = kfifo_to_user(&acer_rec.ring, buf, count, &copied);
+	mutex_unlock(&acer_rec.read_lock);
+
+	if (err)
 		return err;
+	return copied;
 }
 
-static void acer_platform_remove(struct platform_device *device)
+static const struct file_operations acer_rec_fops = {
+	.owner = THIS_MODULE,
+	.read = acer_rec_read,
+	.llseek = noop_llseek,
+};
+
+/* Returns the number of records, fills recs when given */
+static int acer_replay_walk(struct acer_replay_rec *recs)
 {
-	if (has_cap(ACER_CAP_MAILLED))
-		acer_led_exit();
-	if (has_cap(ACER_CAP_BRIGHTNESS))
-		acer_backlight_exit();
+	const struct acer_rec *rec;
+	size_t pos = 0, left;
+	u32 in_len, out_len;
+	int nr = 0;
+
+	while (pos < acer_replay.len) {
+		left = acer_replay.len - pos;
+		if (left < sizeof(*rec))
+			return -EINVAL;
+
+		rec = (const struct acer_rec *)(acer_replay.buf + pos);
+		in_len = le16_to_cpu(rec->in_len);
+		out_len = le16_to_cpu(rec->out_len);
+		if (left - sizeof(*rec) < in_len + out_len)
+			return -EINVAL;
+
+		if (recs) {
+			recs[nr].rec = rec;
+			recs[nr].in = (const u8 *)(rec + 1);
+			recs[nr].out = recs[nr].in + in_len;
+			/* Events are fed by acer_replay_event_work() */
+			recs[nr].used = rec->type == ACER_REC_EVENT;
+		}
+		nr++;
+		pos += sizeof(*rec) + in_len + out_len;
+	}
 
-	acer_rfkill_exit();
+	return nr;
 }
 
-#ifdef CONFIG_PM_SLEEP
-static int acer_suspend(struct device *dev)
+static void acer_replay_event_work(struct work_struct *work)
 {
-	u32 value;
-	struct acer_data *data = &interface->data;
+	struct event_return_value event;
+	const struct acer_replay_rec *r;
+	u64 now, due;
+
+	while (READ_ONCE(acer_replay.active) &&
+	       acer_replay.next_event < acer_replay.nr) {
+		r = &acer_replay.recs[acer_replay.next_event];
+		if (r->rec->type != ACER_REC_EVENT ||
+		    le16_to_cpu(r->rec->in_len) != sizeof(event)) {
+			acer_replay.next_event++;
+			continue;
+		}
 
-	if (!data)
-		return -ENOMEM;
+		if (READ_ONCE(acer_replay.realtime)) {
+			due = acer_replay.start_ns + le64_to_cpu(r->rec->time_ns);
+			now = ktime_get_ns();
+			if (now < due) {
+				schedule_delayed_work(&acer_replay.event_work,
+						      nsecs_to_jiffies(due - now));
+				return;
+			}
+		}
 
-	if (has_cap(ACER_CAP_MAILLED)) {
-		get_u32(&value, ACER_CAP_MAILLED);
-		set_u32(LED_OFF, ACER_CAP_MAILLED);
-		data->mailled = value;
-	}
+		memcpy(&event, r->in, sizeof(event));
+		acer_replay.next_event++;
 
-	if (has_cap(ACER_CAP_BRIGHTNESS)) {
-		get_u32(&value, ACER_CAP_BRIGHTNESS);
-		data->brightness = value;
+		mutex_lock(&acer_event_lock);
+		acer_wmi_handle_event(event);
+		mutex_unlock(&acer_event_lock);
 	}
-
-	return 0;
 }
 
-static int acer_resume(struct device *dev)
+static int acer_replay_start(void)
 {
-	struct acer_data *data = &interface->data;
+	struct acer_replay_rec *recs;
+	int nr;
 
-	if (!data)
+	nr = acer_replay_walk(NULL);
+	if (nr <= 0)
+		return nr ? nr : -ENODATA;
+
+	recs = kvcalloc(nr, sizeof(*recs), GFP_KERNEL);
+	if (!recs)
 		return -ENOMEM;
+	acer_replay_walk(recs);
 
-	if (has_cap(ACER_CAP_MAILLED))
-		set_u32(data->mailled, ACER_CAP_MAILLED);
+	down_write(&acer_replay.trace_sem);
+	acer_replay.recs = recs;
+	acer_replay.nr = nr;
+	acer_replay.first_unused = 0;
+	acer_replay.next_event = 0;
+	acer_replay.hits = 0;
+	acer_replay.misses = 0;
+	acer_replay.start_ns = ktime_get_ns();
+	up_write(&acer_replay.trace_sem);
 
-	if (has_cap(ACER_CAP_BRIGHTNESS))
-		set_u32(data->brightness, ACER_CAP_BRIGHTNESS);
+	WRITE_ONCE(acer_replay.active, true);
+	schedule_delayed_work(&acer_replay.event_work, 0);
 
-	if (acer_wmi_accel_dev)
-		acer_gsensor_init();
+	return 0;
+}
+
+/* Called with acer_replay.lock held, or on unload */
+static void acer_replay_stop(void)
+{
+	WRITE_ONCE(acer_replay.active, false);
+	cancel_delayed_work_sync(&acer_replay.event_work);
+
+	/* Wait for the calls still using the trace */
+	down_write(&acer_replay.trace_sem);
+	kvfree(acer_replay.recs);
+	acer_replay.recs = NULL;
+	acer_replay.nr = 0;
+	up_write(&acer_replay.trace_sem);
+}
 
+static int acer_replay_enable_get(void *data, u64 *val)
+{
+	*val = READ_ONCE(acer_replay.active);
 	return 0;
 }
-#else
-#define acer_suspend	NULL
-#define acer_resume	NULL
-#endif
 
-static SIMPLE_DEV_PM_OPS(acer_pm, acer_suspend, acer_resume);
+static int acer_replay_enable_set(void *data, u64 val)
+{
+	int err = 0;
 
-static void acer_platform_shutdown(struct platform_device *device)
+	mutex_lock(&acer_replay.lock);
+	if (val && !acer_replay.active)
+		err = acer_replay_start();
+	else if (!val && acer_replay.active)
+		acer_replay_stop();
+	mutex_unlock(&acer_replay.lock);
+
+	return err;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(acer_replay_enable_fops, acer_replay_enable_get,
+			 acer_replay_enable_set, "%llu\n");
+
+/* Load a trace, a write at offset 0 starts a new one */
+static ssize_t acer_replay_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
 {
-	struct acer_data *data = &interface->data;
+	loff_t pos = *ppos;
+	ssize_t ret = count;
 
-	if (!data)
-		return;
+	mutex_lock(&acer_replay.lock);
+	if (acer_replay.active) {
+		ret = -EBUSY;
+		goto out;
+	}
 
-	if (has_cap(ACER_CAP_MAILLED))
-		set_u32(LED_OFF, ACER_CAP_MAILLED);
+	if (!acer_replay.buf) {
+		acer_replay.size = (size_t)record_kb * 1024;
+		acer_replay.buf = kvzalloc(acer_replay.size, GFP_KERNEL);
+		if (!acer_replay.buf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (pos < 0 || pos > acer_replay.size || count > acer_replay.size - pos) {
+		ret = -EFBIG;
+		goto out;
+	}
+
+	down_write(&acer_replay.trace_sem);
+	if (copy_from_user(acer_replay.buf + pos, buf, count)) {
+		ret = -EFAULT;
+	} else {
+		acer_replay.len = pos + count;
+		*ppos = pos + count;
+	}
+	up_write(&acer_replay.trace_sem);
+out:
+	mutex_unlock(&acer_replay.lock);
+	return ret;
 }
 
-static struct platform_driver acer_platform_driver = {
-		.driver = {
-				.name = "acer-wmi",
-				.pm = &acer_pm,
-		},
-		.probe = acer_platform_probe,
-		#if RTLNX_VER_MIN(6, 14, 0)
-		.remove = acer_platform_remove,
-		#else
-		.remove = (void*)acer_platform_remove,
-		#endif
-		.shutdown = acer_platform_shutdown,
+static const struct file_operations acer_replay_fops = {
+	.owner = THIS_MODULE,
+	.write = acer_replay_write,
 };
 
-static struct platform_device *acer_platform_device;
+static void __init acer_rec_create_debugfs(struct dentry *root)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("record", root);
+	debugfs_create_file_unsafe("enable", 0644, dir, NULL, &acer_rec_enable_fops);
+	debugfs_create_file("data", 0400, dir, NULL, &acer_rec_fops);
+	debugfs_create_u64("records", 0444, dir, &acer_rec.records);
+	debugfs_create_u64("dropped", 0444, dir, &acer_rec.dropped);
+
+	dir = debugfs_create_dir("replay", root);
+	debugfs_create_file_unsafe("enable", 0644, dir, NULL, &acer_replay_enable_fops);
+	debugfs_create_file("data", 0200, dir, NULL, &acer_replay_fops);
+	debugfs_create_bool("realtime", 0644, dir, &acer_replay.realtime);
+	debugfs_create_u64("hits", 0444, dir, &acer_replay.hits);
+	debugfs_create_u64("misses", 0444, dir, &acer_replay.misses);
+}
+
+static void acer_rec_free(void)
+{
+	acer_rec_stop();
+	kfifo_free(&acer_rec.ring);
+	kvfree(acer_replay.buf);
+}
 
 static void remove_debugfs(void)
 {
@@ -3717,8 +7998,30 @@ static void __init create_debugfs(void)
 {
 	interface->debug.root = debugfs_create_dir("acer-wmi", NULL);
 
-	debugfs_create_u32("devices", S_IRUGO, interface->debug.root,
-			   &interface->debug.wmid_devices);
+	if (has_guid(ACER_GUID_WMID_2))
+		debugfs_create_u32("devices", S_IRUGO, interface->debug.root,
+				   &interface->debug.wmid_devices);
+
+	debugfs_create_atomic_t("wmi_result_overflows", 0444, interface->debug.root,
+				&acer_wmi_result_overflows);
+	debugfs_create_file("latency", 0444, interface->debug.root, NULL,
+			    &acer_lat_fops);
+	debugfs_create_file("latency_reset", 0200, interface->debug.root, NULL,
+			    &acer_lat_reset_fops);
+	debugfs_create_file("scheduler", 0444, interface->debug.root, NULL,
+			    &acer_cmd_stats_fops);
+	debugfs_create_file("state", 0444, interface->debug.root, NULL,
+			    &acer_state_fops);
+	debugfs_create_file("sensors", 0444, interface->debug.root, NULL,
+			    &acer_sensors_fops);
+
+	if (gaming_interface)
+		gaming_kbbl_create_debugfs(interface->debug.root);
+
+	if (mock)
+		acer_mock_create_debugfs(interface->debug.root);
+
+	acer_rec_create_debugfs(interface->debug.root);
 }
 
 static umode_t acer_wmi_hwmon_is_visible(const void *data,
@@ -3727,7 +8030,11 @@ static umode_t acer_wmi_hwmon_is_visible(const void *data,
 {
 	switch (type) {
 	case hwmon_fan:
-		if (acer_get_fan_speed(channel) >= 0)
+		if (test_bit(channel, &acer_sensors_present))
+			return 0444;
+		break;
+	case hwmon_temp:
+		if (test_bit(ACER_SENSOR_FIRST_TEMP + channel, &acer_sensors_present))
 			return 0444;
 		break;
 	default:
@@ -3749,6 +8056,8 @@ static int acer_wmi_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
 			return ret;
 		*val = ret;
 		break;
+	case hwmon_temp:
+		return acer_get_temperature(ACER_SENSOR_FIRST_TEMP + channel, val);
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -3756,12 +8065,31 @@ static int acer_wmi_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
 	return 0;
 }
 
+static int acer_wmi_hwmon_read_string(struct device *dev,
+				      enum hwmon_sensor_types type, u32 attr,
+				      int channel, const char **str)
+{
+	switch (type) {
+	case hwmon_temp:
+		*str = acer_sensors[ACER_SENSOR_FIRST_TEMP + channel].label;
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
 static const struct hwmon_channel_info *const acer_wmi_hwmon_info[] = {
-	HWMON_CHANNEL_INFO(fan, HWMON_F_INPUT, HWMON_F_INPUT), NULL
+	HWMON_CHANNEL_INFO(fan, HWMON_F_INPUT, HWMON_F_INPUT),
+	HWMON_CHANNEL_INFO(temp,
+			   HWMON_T_INPUT | HWMON_T_LABEL,
+			   HWMON_T_INPUT | HWMON_T_LABEL,
+			   HWMON_T_INPUT | HWMON_T_LABEL),
+	NULL
 };
 
 static const struct hwmon_ops acer_wmi_hwmon_ops = {
 	.read = acer_wmi_hwmon_read,
+	.read_string = acer_wmi_hwmon_read_string,
 	.is_visible = acer_wmi_hwmon_is_visible,
 };
 
@@ -3775,6 +8103,8 @@ static int acer_wmi_hwmon_init(void)
 	struct device *dev = &acer_platform_device->dev;
 	struct device *hwmon;
 
+	acer_sensors_probe();
+
 	hwmon = devm_hwmon_device_register_with_info(dev, "acer",
 						     &acer_platform_driver,
 						     &acer_wmi_hwmon_chip_info,
@@ -3788,12 +8118,314 @@ static int acer_wmi_hwmon_init(void)
 	return 0;
 }
 
-static int __init acer_wmi_init(void)
+/*
+ * IIO device
+ * Streams the present sensors through a triggered buffer, typically driven
+ * by an iio-trig-hrtimer trigger. Each scan reads the sensors from the
+ * firmware and holds their raw values and a timestamp.
+ */
+#if IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER)
+
+#if RTLNX_VER_MAX(6, 11, 0)
+#define iio_for_each_active_channel(indio_dev, chan)			\
+	for_each_set_bit(chan, (indio_dev)->active_scan_mask,		\
+			 (indio_dev)->masklength)
+#endif
+
+/* Fans report RPM, IIO angular velocity is in rad/s: 2 * pi / 60 */
+#define ACER_IIO_RPM_SCALE_NANO 104719755
+
+#define ACER_IIO_CHAN(_id, _type, _index)				\
+	{								\
+		.type = _type,						\
+		.indexed = 1,						\
+		.channel = _index,					\
+		.address = _id,						\
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),		\
+		.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),	\
+		.scan_index = _id,					\
+		.scan_type = {						\
+			.sign = 'u',					\
+			.realbits = 16,					\
+			.storagebits = 16,				\
+			.endianness = IIO_CPU,				\
+		},							\
+	}
+
+static const struct iio_chan_spec acer_iio_channels[] = {
+	ACER_IIO_CHAN(ACER_SENSOR_CPU_FAN, IIO_ANGL_VEL, 0),
+	ACER_IIO_CHAN(ACER_SENSOR_GPU_FAN, IIO_ANGL_VEL, 1),
+	ACER_IIO_CHAN(ACER_SENSOR_CPU_TEMP, IIO_TEMP, 0),
+	ACER_IIO_CHAN(ACER_SENSOR_EXT_TEMP, IIO_TEMP, 1),
+	ACER_IIO_CHAN(ACER_SENSOR_GPU_TEMP, IIO_TEMP, 2),
+	IIO_CHAN_SOFT_TIMESTAMP(ACER_SENSOR_COUNT),
+};
+
+static irqreturn_t acer_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct {
+		u16 values[ACER_SENSOR_COUNT];
+		s64 timestamp __aligned(8);
+	} scan = { };
+	u64 value;
+	int bit, i = 0;
+
+	iio_for_each_active_channel(indio_dev, bit) {
+		/* Drop the scan rather than push a partial one */
+		if (acer_sensor_refresh(bit, &value))
+			goto done;
+		scan.values[i++] = acer_sensor_decode(bit, value);
+	}
+
+	iio_push_to_buffers_with_timestamp(indio_dev, &scan, pf->timestamp);
+done:
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
+
+static int acer_iio_read_raw(struct iio_dev *indio_dev,
+			     struct iio_chan_spec const *chan, int *val,
+			     int *val2, long mask)
+{
+	u64 value;
+	int err;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		err = acer_sensor_read(chan->address, &value);
+		if (err)
+			return err;
+		*val = acer_sensor_decode(chan->address, value);
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		if (chan->type == IIO_TEMP) {
+			/* Millidegrees Celsius */
+			*val = 1000;
+			return IIO_VAL_INT;
+		}
+		*val = 0;
+		*val2 = ACER_IIO_RPM_SCALE_NANO;
+		return IIO_VAL_INT_PLUS_NANO;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int acer_iio_read_label(struct iio_dev *indio_dev,
+			       struct iio_chan_spec const *chan, char *label)
+{
+	return sysfs_emit(label, "%s\n", acer_sensors[chan->address].label);
+}
+
+static const struct iio_info acer_iio_info = {
+	.read_raw = acer_iio_read_raw,
+	.read_label = acer_iio_read_label,
+};
+
+static int acer_iio_init(struct device *dev)
+{
+	struct iio_chan_spec *channels;
+	struct iio_dev *indio_dev;
+	int i, n = 0, err;
+
+	if (!acer_sensors_present)
+		return 0;
+
+	/* Only the present sensors, and the timestamp */
+	channels = devm_kcalloc(dev, ARRAY_SIZE(acer_iio_channels),
+				sizeof(*channels), GFP_KERNEL);
+	if (!channels)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(acer_iio_channels); i++) {
+		if (acer_iio_channels[i].type != IIO_TIMESTAMP &&
+		    !test_bit(acer_iio_channels[i].address, &acer_sensors_present))
+			continue;
+		channels[n++] = acer_iio_channels[i];
+	}
+
+	indio_dev = devm_iio_device_alloc(dev, 0);
+	if (!indio_dev)
+		return -ENOMEM;
+
+	indio_dev->name = "acer-wmi";
+	indio_dev->info = &acer_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = channels;
+	indio_dev->num_channels = n;
+
+	err = devm_iio_triggered_buffer_setup(dev, indio_dev,
+					      iio_pollfunc_store_time,
+					      acer_iio_trigger_handler, NULL);
+	if (err)
+		return err;
+
+	return devm_iio_device_register(dev, indio_dev);
+}
+
+#else
+
+static int acer_iio_init(struct device *dev)
+{
+	return 0;
+}
+
+#endif
+
+/*
+ * Thermal zones
+ * One zone per present temperature sensor, polled by the thermal core
+ * every thermal_poll_ms, with the passive and critical trip points from
+ * the module parameters. Both trips can be changed through sysfs.
+ * Readings are kept for half a polling interval, so other readers of the
+ * zone temperature between two polls don't call the firmware.
+ */
+#if RTLNX_VER_MIN(6, 4, 0) && IS_REACHABLE(CONFIG_THERMAL)
+
+#define ACER_THERMAL_HYSTERESIS 2000
+#define ACER_THERMAL_MAX_TRIPS 2
+
+struct acer_thermal_zone {
+	struct thermal_zone_device *tz;
+	/* Older cores keep a pointer to the trips instead of a copy */
+	struct thermal_trip trips[ACER_THERMAL_MAX_TRIPS];
+	enum acer_sensor_id id;
+	/* Protected by the zone lock, held by the core around get_temp */
+	u64 stamp_ns;
+	int temp;
+};
+
+static struct acer_thermal_zone acer_thermal_zones[ACER_SENSOR_COUNT - ACER_SENSOR_FIRST_TEMP];
+
+static const char * const acer_thermal_types[] = {
+	[ACER_SENSOR_CPU_TEMP - ACER_SENSOR_FIRST_TEMP] = "acer-cpu",
+	[ACER_SENSOR_EXT_TEMP - ACER_SENSOR_FIRST_TEMP] = "acer-ext",
+	[ACER_SENSOR_GPU_TEMP - ACER_SENSOR_FIRST_TEMP] = "acer-gpu",
+};
+
+static int acer_thermal_get_temp(struct thermal_zone_device *tz, int *temp)
+{
+	struct acer_thermal_zone *zone = thermal_zone_device_priv(tz);
+	u64 window = (u64)thermal_poll_ms * NSEC_PER_MSEC / 2;
+	u64 now = ktime_get_ns();
+	u64 reading;
+	int value;
+	int err;
+
+	if (zone->stamp_ns && now - zone->stamp_ns < window) {
+		*temp = zone->temp;
+		return 0;
+	}
+
+	err = acer_sensor_read_untouched(zone->id, &reading);
+	if (err)
+		return err;
+
+	value = acer_sensor_decode(zone->id, reading) * 1000;
+	zone->temp = value;
+	zone->stamp_ns = now;
+	*temp = value;
+
+	return 0;
+}
+
+static struct thermal_zone_device_ops acer_thermal_ops = {
+	.get_temp = acer_thermal_get_temp,
+};
+
+static void acer_thermal_unregister(void *data)
+{
+	struct acer_thermal_zone *zone = data;
+
+	thermal_zone_device_unregister(zone->tz);
+	zone->tz = NULL;
+}
+
+static int acer_thermal_init(struct device *dev)
+{
+	struct thermal_trip trips[ACER_THERMAL_MAX_TRIPS] = { };
+	struct acer_thermal_zone *zone;
+	int i, num_trips = 0, err;
+
+	if (!thermal_poll_ms)
+		return 0;
+
+	if (thermal_passive > 0) {
+		trips[num_trips].type = THERMAL_TRIP_PASSIVE;
+		trips[num_trips].temperature = thermal_passive;
+		trips[num_trips].hysteresis = ACER_THERMAL_HYSTERESIS;
+		num_trips++;
+	}
+	if (thermal_critical > 0) {
+		trips[num_trips].type = THERMAL_TRIP_CRITICAL;
+		trips[num_trips].temperature = thermal_critical;
+		num_trips++;
+	}
+
+	#if RTLNX_VER_MIN(6, 9, 0)
+	for (i = 0; i < num_trips; i++)
+		trips[i].flags = THERMAL_TRIP_FLAG_RW_TEMP;
+	#endif
+
+	for (i = ACER_SENSOR_FIRST_TEMP; i < ACER_SENSOR_COUNT; i++) {
+		if (!test_bit(i, &acer_sensors_present))
+			continue;
+
+		zone = &acer_thermal_zones[i - ACER_SENSOR_FIRST_TEMP];
+		zone->id = i;
+		memcpy(zone->trips, trips, sizeof(trips));
+
+		#if RTLNX_VER_MIN(6, 9, 0)
+		zone->tz = thermal_zone_device_register_with_trips(
+				acer_thermal_types[i - ACER_SENSOR_FIRST_TEMP],
+				zone->trips, num_trips, zone, &acer_thermal_ops,
+				NULL, thermal_poll_ms, thermal_poll_ms);
+		#else
+		/* All trips writable */
+		zone->tz = thermal_zone_device_register_with_trips(
+				acer_thermal_types[i - ACER_SENSOR_FIRST_TEMP],
+				zone->trips, num_trips, BIT(num_trips) - 1,
+				zone, &acer_thermal_ops, NULL,
+				thermal_poll_ms, thermal_poll_ms);
+		#endif
+		if (IS_ERR(zone->tz)) {
+			err = PTR_ERR(zone->tz);
+			zone->tz = NULL;
+			return err;
+		}
+
+		err = devm_add_action_or_reset(dev, acer_thermal_unregister, zone);
+		if (err)
+			return err;
+
+		err = thermal_zone_device_enable(zone->tz);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+#else
+
+static int acer_thermal_init(struct device *dev)
+{
+	return 0;
+}
+
+#endif
+
+static int __init acer_wmi_setup(void)
 {
 	int err;
 
 	pr_info("Acer Laptop ACPI-WMI Extras\n");
 
+	acer_guids_init();
+
 	if (dmi_check_system(acer_blacklist)) {
 		pr_info("Blacklisted hardware detected - not loading\n");
 		return -ENODEV;
@@ -3812,7 +8444,7 @@ static int __init acer_wmi_init(void)
 	 * should be in Acer/Gateway/Packard Bell white list, or it's already
 	 * in the past quirk list.
 	 */
-	if (wmi_has_guid(AMW0_GUID1) &&
+	if (has_guid(ACER_GUID_AMW0_1) &&
 	    !dmi_check_system(amw0_whitelist) &&
 	    quirks == &quirk_unknown) {
 		pr_debug("Unsupported machine has AMW0_GUID1, unable to load\n");
@@ -3822,34 +8454,34 @@ static int __init acer_wmi_init(void)
 	/*
 	 * Detect which ACPI-WMI interface we're using.
 	 */
-	if (wmi_has_guid(AMW0_GUID1) && wmi_has_guid(WMID_GUID1))
+	if (has_guid(ACER_GUID_AMW0_1) && has_guid(ACER_GUID_WMID_1))
 		interface = &AMW0_V2_interface;
 
-	if (!wmi_has_guid(AMW0_GUID1) && wmi_has_guid(WMID_GUID1))
+	if (!has_guid(ACER_GUID_AMW0_1) && has_guid(ACER_GUID_WMID_1))
 		interface = &wmid_interface;
 
-	if (wmi_has_guid(WMID_GUID3)) {
+	if (has_guid(ACER_GUID_WMID_3)) {
 		interface = &wmid_v2_interface;
-		if (wmi_has_guid(WMID_GUID4))
+		if (has_guid(ACER_GUID_WMID_4))
 			gaming_interface = &wmid_gaming_interface;
 	}
 
 	if (interface)
 		dmi_walk(type_aa_dmi_decode, NULL);
 
-	if (wmi_has_guid(WMID_GUID2) && interface) {
+	if (has_guid(ACER_GUID_WMID_2) && interface) {
 		if (!has_type_aa && ACPI_FAILURE(WMID_set_capabilities())) {
 			pr_err("Unable to detect available WMID devices\n");
 			return -ENODEV;
 		}
 		/* WMID always provides brightness methods */
 		interface->capability |= ACER_CAP_BRIGHTNESS;
-	} else if (!wmi_has_guid(WMID_GUID2) && interface && !has_type_aa && force_caps == -1) {
+	} else if (!has_guid(ACER_GUID_WMID_2) && interface && !has_type_aa && force_caps == -1) {
 		pr_err("No WMID device detection method found\n");
 		return -ENODEV;
 	}
 
-	if (wmi_has_guid(AMW0_GUID1) && !wmi_has_guid(WMID_GUID1)) {
+	if (has_guid(ACER_GUID_AMW0_1) && !has_guid(ACER_GUID_WMID_1)) {
 		interface = &AMW0_interface;
 
 		if (ACPI_FAILURE(AMW0_set_capabilities())) {
@@ -3858,7 +8490,7 @@ static int __init acer_wmi_init(void)
 		}
 	}
 
-	if (wmi_has_guid(AMW0_GUID1))
+	if (has_guid(ACER_GUID_AMW0_1))
 		AMW0_find_mailled();
 
 	if (!interface) {
@@ -3866,14 +8498,16 @@ static int __init acer_wmi_init(void)
 		return -ENODEV;
 	}
 
+	acer_cap_ops_init();
+
 	set_quirks();
 
 	if (acpi_video_get_backlight_type() != acpi_backlight_vendor)
 		interface->capability &= ~ACER_CAP_BRIGHTNESS;
 
-	if (wmi_has_guid(WMID_GUID3)) {
+	if (has_guid(ACER_GUID_WMID_3)) {
 		interface->capability |= ACER_CAP_SET_FUNCTION_MODE;
-		if (wmi_has_guid(WMID_GUID4)) {
+		if (has_guid(ACER_GUID_WMID_4)) {
 			gaming_interface->capability |= ACER_CAP_GAMINGKB | ACER_CAP_GAMINGKB_STATIC;
 			gaming_kbbl_cdev_init();
 			gaming_kbbl_static_cdev_init();
@@ -3884,7 +8518,7 @@ static int __init acer_wmi_init(void)
 	if (force_caps != -1)
 		interface->capability = force_caps;
 
-	if (wmi_has_guid(WMID_GUID3) &&
+	if (has_guid(ACER_GUID_WMID_3) &&
 	    (interface->capability & ACER_CAP_SET_FUNCTION_MODE)) {
 		if (ACPI_FAILURE(acer_wmi_enable_rf_button()))
 			pr_warn("Cannot enable RF Button Driver\n");
@@ -3902,7 +8536,7 @@ static int __init acer_wmi_init(void)
 		pr_info("No WMID EC raw mode enable method\n");
 	}
 
-	if (wmi_has_guid(ACERWMID_EVENT_GUID)) {
+	if (has_guid(ACER_GUID_EVENT)) {
 		err = acer_wmi_input_setup();
 		if (err)
 			return err;
@@ -3927,10 +8561,9 @@ static int __init acer_wmi_init(void)
 	if (err)
 		goto error_device_add;
 
-	if (wmi_has_guid(WMID_GUID2)) {
+	if (has_guid(ACER_GUID_WMID_2))
 		interface->debug.wmid_devices = get_wmid_devices();
-		create_debugfs();
-	}
+	create_debugfs();
 
 	/* Override any initial settings with values from the commandline */
 	acer_commandline_init();
@@ -3942,7 +8575,7 @@ error_device_add:
 error_device_alloc:
 	platform_driver_unregister(&acer_platform_driver);
 error_platform_register:
-	if (wmi_has_guid(ACERWMID_EVENT_GUID))
+	if (has_guid(ACER_GUID_EVENT))
 		acer_wmi_input_destroy();
 	if (acer_wmi_accel_dev)
 		input_unregister_device(acer_wmi_accel_dev);
@@ -3950,15 +8583,35 @@ error_platform_register:
 	return err;
 }
 
+static int __init acer_wmi_init(void)
+{
+	int err;
+
+	acer_wmi_methods_check();
+
+	err = acer_cmd_init();
+	if (err)
+		return err;
+
+	err = acer_wmi_setup();
+	if (err)
+		acer_cmd_exit();
+
+	return err;
+}
+
 static void __exit acer_wmi_exit(void)
 {
-	if (wmi_has_guid(ACERWMID_EVENT_GUID))
+	acer_replay_stop();
+	acer_sampler_stop();
+
+	if (has_guid(ACER_GUID_EVENT))
 		acer_wmi_input_destroy();
 
 	if (acer_wmi_accel_dev)
 		input_unregister_device(acer_wmi_accel_dev);
 
-	if (wmi_has_guid(WMID_GUID4)) {
+	if (has_guid(ACER_GUID_WMID_4)) {
 		gaming_kbbl_cdev_exit();
 		gaming_kbbl_static_cdev_exit();
 	}
@@ -3966,6 +8619,8 @@ static void __exit acer_wmi_exit(void)
 	remove_debugfs();
 	platform_device_unregister(acer_platform_device);
 	platform_driver_unregister(&acer_platform_driver);
+	acer_cmd_exit();
+	acer_rec_free();
 
 	pr_info("Acer Laptop WMI Extras unloaded\n");
 }
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Tracepoints of the Acer WMI Laptop Extras driver
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM acer_wmi
+
+#if !defined(_FACER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _FACER_TRACE_H
+
+#include <linux/acpi.h>
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+/* Largest part of a WMI input buffer copied into the trace */
+#define ACER_TRACE_INPUT_MAX 32
+
+/* __assign_str() lost its source argument in 6.10 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+#define acer_trace_assign_str(dst, src) __assign_str(dst)
+#else
+#define acer_trace_assign_str(dst, src) __assign_str(dst, src)
+#endif
+
+TRACE_EVENT(acer_wmi_method_entry,
+
+	TP_PROTO(const char *guid, u32 method_id, const struct acpi_buffer *in),
+
+	TP_ARGS(guid, method_id, in),
+
+	TP_STRUCT__entry(
+		__string(guid, guid)
+		__field(u32, method_id)
+		__field(u32, in_len)
+		__dynamic_array(u8, input,
+				in ? min_t(u32, in->length, ACER_TRACE_INPUT_MAX) : 0)
+	),
+
+	TP_fast_assign(
+		acer_trace_assign_str(guid, guid);
+		__entry->method_id = method_id;
+		__entry->in_len = in ? in->length : 0;
+		if (in && in->pointer)
+			memcpy(__get_dynamic_array(input), in->pointer,
+			       __get_dynamic_array_len(input));
+	),
+
+	TP_printk("guid=%s method=%u in_len=%u input=%s",
+		  __get_str(guid), __entry->method_id, __entry->in_len,
+		  __print_hex(__get_dynamic_array(input),
+			      __get_dynamic_array_len(input)))
+);
+
+/*
+ * value is the integer result, or the first 8 bytes of a buffer result
+ * in little endian.
+ */
+TRACE_EVENT(acer_wmi_method_exit,
+
+	TP_PROTO(const char *guid, u32 method_id, acpi_status status,
+		 const struct acpi_buffer *out, u64 duration_ns),
+
+	TP_ARGS(guid, method_id, status, out, duration_ns),
+
+	TP_STRUCT__entry(
+		__string(guid, guid)
+		__field(u32, method_id)
+		__field(u32, status)
+		__field(u32, type)
+		__field(u32, length)
+		__field(u64, value)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		const union acpi_object *obj = NULL;
+
+		if (ACPI_SUCCESS(status) && out && out->pointer && out->length)
+			obj = out->pointer;
+
+		acer_trace_assign_str(guid, guid);
+		__entry->method_id = method_id;
+		__entry->status = status;
+		__entry->type = obj ? obj->type : ACPI_TYPE_ANY;
+		__entry->length = 0;
+		__entry->value = 0;
+		if (obj && obj->type == ACPI_TYPE_INTEGER) {
+			__entry->value = obj->integer.value;
+		} else if (obj && obj->type == ACPI_TYPE_BUFFER) {
+			__entry->length = obj->buffer.length;
+			memcpy(&__entry->value, obj->buffer.pointer,
+			       min_t(u32, obj->buffer.length, sizeof(u64)));
+			le64_to_cpus(&__entry->value);
+		}
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("guid=%s method=%u status=0x%x type=%u length=%u value=0x%llx duration_ns=%llu",
+		  __get_str(guid), __entry->method_id, __entry->status,
+		  __entry->type, __entry->length, __entry->value,
+		  __entry->duration_ns)
+);
+
+TRACE_EVENT(acer_ec_access,
+
+	TP_PROTO(bool write, u8 addr, u8 value, int err, u64 duration_ns),
+
+	TP_ARGS(write, addr, value, err, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(bool, write)
+		__field(u8, addr)
+		__field(u8, value)
+		__field(int, err)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->write = write;
+		__entry->addr = addr;
+		__entry->value = value;
+		__entry->err = err;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("%s addr=0x%02x value=0x%02x err=%d duration_ns=%llu",
+		  __entry->write ? "write" : "read", __entry->addr,
+		  __entry->value, __entry->err, __entry->duration_ns)
+);
+
+TRACE_EVENT(acer_wmi_event,
+
+	TP_PROTO(u8 function, u8 key_num, u16 device_state, u8 kbd_dock_state),
+
+	TP_ARGS(function, key_num, device_state, kbd_dock_state),
+
+	TP_STRUCT__entry(
+		__field(u8, function)
+		__field(u8, key_num)
+		__field(u16, device_state)
+		__field(u8, kbd_dock_state)
+	),
+
+	TP_fast_assign(
+		__entry->function = function;
+		__entry->key_num = key_num;
+		__entry->device_state = device_state;
+		__entry->kbd_dock_state = kbd_dock_state;
+	),
+
+	TP_printk("function=0x%x key=0x%x device_state=0x%x kbd_dock_state=0x%x",
+		  __entry->function, __entry->key_num, __entry->device_state,
+		  __entry->kbd_dock_state)
+);
+
+/* Writes and ioctls on the keyboard backlight character devices */
+TRACE_EVENT(acer_gkbbl_submit,
+
+	TP_PROTO(const char *source, const void *data, size_t len, bool async),
+
+	TP_ARGS(source, data, len, async),
+
+	TP_STRUCT__entry(
+		__string(source, source)
+		__field(bool, async)
+		__dynamic_array(u8, payload, len)
+	),
+
+	TP_fast_assign(
+		acer_trace_assign_str(source, source);
+		__entry->async = async;
+		memcpy(__get_dynamic_array(payload), data, len);
+	),
+
+	TP_printk("%s%s data=%s", __get_str(source),
+		  __entry->async ? " async" : "",
+		  __print_hex(__get_dynamic_array(payload),
+			      __get_dynamic_array_len(payload)))
+);
+
+#endif /* _FACER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE facer_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,139 @@
+#!/bin/bash
+#
+# Stress test of the driver locking against the simulated firmware.
+# Loads src/facer.ko with mock=1 and runs, at the same time, platform
+# profile writes, readers of the debugfs state, keyboard backlight writes
+# and turbo and mode key events injected through mock/event. Fails if an
+# operation hangs, the module can't be unloaded, or the kernel log shows a
+# lockdep report, warning or hung task.
+#
+# Usage: sudo ./stress_test.sh [seconds]   (default 60)
+# Build the module first. A kernel with CONFIG_PROVE_LOCKING finds lock
+# order problems that the run itself doesn't hit.
+
+DURATION=${1:-60}
+MODULE=src/facer.ko
+DEBUGFS=/sys/kernel/debug/acer-wmi
+PROFILE=/sys/firmware/acpi/platform_profile
+OP_TIMEOUT=10
+FAILED=$(mktemp)
+
+if [[ $EUID -ne 0 ]]; then
+   echo "[*] This script must be run as root"
+   exit 1
+fi
+
+if [[ ! -f $MODULE ]]; then
+    echo "[*] $MODULE not found, run make first"
+    exit 1
+fi
+
+if [[ ! -f /proc/lockdep ]]; then
+    echo "[*] Lockdep is not enabled in this kernel, only hangs and warnings are detected"
+fi
+
+# Run one operation, note it if it doesn't finish
+op() {
+    timeout $OP_TIMEOUT "$@" > /dev/null 2>&1
+    if [[ $? -eq 124 ]]; then
+        echo "hung: $*" >> "$FAILED"
+    fi
+}
+
+# Run a worker function until the end of the test
+run() {
+    local end=$((SECONDS + DURATION))
+    while [[ $SECONDS -lt $end ]]; do
+        "$@"
+    done
+}
+
+profile_writer() {
+    local p
+    for p in $(cat ${PROFILE}_choices); do
+        op sh -c "echo $p > $PROFILE"
+    done
+}
+
+profile_reader() {
+    op cat $PROFILE
+}
+
+state_reader() {
+    op cat $DEBUGFS/state
+}
+
+rgb_writer() {
+    # Static, then wave effect on the dynamic device
+    op bash -c "printf '\x00\x04\x32\x00\x00\xff\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00' > /dev/acer-gkbbl-0"
+    op bash -c "printf '\x03\x04\x32\x08\x01\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00' > /dev/acer-gkbbl-0"
+    # All four zones on the static device
+    op bash -c "printf '\x0f\x00\xff\x00' > /dev/acer-gkbbl-static-0"
+}
+
+hotkeys() {
+    # Turbo key, then mode key
+    op sh -c "echo 7 4 0 > $DEBUGFS/mock/event"
+    op sh -c "echo 7 5 0 > $DEBUGFS/mock/event"
+}
+
+# The in-tree driver binds the same platform device name
+rmmod acer_wmi 2> /dev/null
+rmmod facer 2> /dev/null
+
+MARKER="acer-wmi stress test $$"
+echo "$MARKER" > /dev/kmsg
+
+if ! insmod $MODULE mock=1; then
+    echo "[*] Could not load $MODULE"
+    exit 1
+fi
+
+# Let udev create the device nodes
+udevadm settle 2> /dev/null
+for dev in /dev/acer-gkbbl-0 /dev/acer-gkbbl-static-0 $PROFILE $DEBUGFS/state $DEBUGFS/mock/event; do
+    if [[ ! -e $dev ]]; then
+        echo "[*] $dev is missing"
+        rmmod facer
+        exit 1
+    fi
+done
+
+echo "[*] Running for $DURATION seconds"
+run profile_writer &
+run profile_writer &
+run profile_reader &
+run state_reader &
+run state_reader &
+run rgb_writer &
+run rgb_writer &
+run hotkeys &
+
+# Workers end on their own, give them the operation timeout to do so
+end=$((SECONDS + DURATION + OP_TIMEOUT * 4))
+while [[ -n "$(jobs -r)" && $SECONDS -lt $end ]]; do
+    sleep 1
+done
+if [[ -n "$(jobs -r)" ]]; then
+    echo "workers did not finish" >> "$FAILED"
+    kill $(jobs -p) 2> /dev/null
+fi
+
+if ! timeout $OP_TIMEOUT rmmod facer; then
+    echo "module unload failed or hung" >> "$FAILED"
+fi
+
+# Kernel messages since the test started
+dmesg | sed -n "/$MARKER/,\$p" | \
+    grep -E "possible circular locking|possible recursive locking|inconsistent lock state|suspicious RCU|BUG:|WARNING:|blocked for more than" \
+    >> "$FAILED"
+
+if [[ -s $FAILED ]]; then
+    echo "[*] FAILED"
+    cat "$FAILED"
+    rm -f "$FAILED"
+    exit 1
+fi
+
+rm -f "$FAILED"
+echo "[*] PASSED"